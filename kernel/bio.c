@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -16,6 +16,7 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
@@ -23,69 +24,219 @@
 #include "fs.h"
 #include "buf.h"
 
+// Buffers are kept in hash buckets by (dev, blockno), each
+// with its own lock, so that looking up different blocks
+// doesn't serialize. A buffer remembers when it was last
+// released; a miss recycles the least recently used free
+// buffer from any bucket and moves it to the block's
+// bucket. bcache.lock serializes misses, so a miss never
+// holds more than two bucket locks.
+//
+// The cache starts with NBUF buffers in bcache.buf[],
+// which are never freed. A miss adds a buffer from
+// kmalloc() instead of recycling one while more than
+// 1/BGROWFREE of memory is free, up to NBUFMAX, and
+// breclaim() frees the least recently used added buffers,
+// BRECLAIM at a time, when kalloc() runs out of memory.
+#define NBUCKET 13
+#define BGROWFREE 4
+#define BRECLAIM 16
+
+struct bucket {
+  struct spinlock lock;
+  struct buf head;  // list of buffers, through prev/next
+  uint64 nhit;
+};
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  uchar data[NBUF][BSIZE];
+  struct bucket bucket[NBUCKET];
+  int nbuf;
+  uint64 nmiss;
+  uint64 nevict;     // misses that recycled a buffer
+  uint64 nshrink;    // buffers freed by breclaim()
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Allocate a buffer that is on no list.
+// Returns 0 if out of memory.
+static struct buf*
+bufalloc(void)
+{
+  struct buf *b;
+
+  if((b = kmalloc(sizeof(*b))) == 0)
+    return 0;
+  memset(b, 0, sizeof(*b));
+  if((b->data = kmalloc(BSIZE)) == 0){
+    kmfree(b);
+    return 0;
+  }
+  initsleeplock(&b->lock, "buffer");
+  // the cache may hold more buffers than the lock table
+  // has slots, and frees them again; keep their locks out
+  // of it.
+  freelock(&b->lock.lk);
+  return b;
+}
+
+static void
+buffree(struct buf *b)
+{
+  kmfree(b->data);
+  kmfree(b);
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Start every buffer in the first bucket.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->data = bcache.data[b - bcache.buf];
+    bpush(&bcache.bucket[0], b);
   }
+  bcache.nbuf = NBUF;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Find block blockno of dev in bucket bk, and take a
+// reference to it. Caller must hold bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk, *v, *victimbk;
+  struct buf *b, *victim;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0)
+    bk->nhit++;
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Not cached. Allocate a new buffer now if the cache
+  // may grow, since kalloc() may call breclaim().
+  victim = 0;
+  if(bcache.nbuf < NBUFMAX && kfreepages() > (PHYSTOP - KERNBASE) / PGSIZE / BGROWFREE)
+    victim = bufalloc();
+
+ again:
+  // Look again now that misses are serialized, in case
+  // another miss just read the block in.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    bk->nhit++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(victim)
+      buffree(victim);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+  bcache.nmiss++;
+
+  if(victim){
+    bcache.nbuf++;
+  } else {
+    // Recycle the least recently used unused buffer,
+    // leaving its bucket locked.
+    victimbk = 0;
+    for(v = bcache.bucket; v < bcache.bucket+NBUCKET; v++){
+      acquire(&v->lock);
+      int found = 0;
+      for(b = v->head.next; b != &v->head; b = b->next){
+        if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+          victim = b;
+          found = 1;
+        }
+      }
+      if(found){
+        if(victimbk)
+          release(&victimbk->lock);
+        victimbk = v;
+      } else {
+        release(&v->lock);
+      }
+    }
+    if(victim == 0){
+      // every buffer is in use: grow the cache
+      // whatever the free memory.
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if((victim = bufalloc()) == 0)
+        panic("bget: no buffers");
+      goto again;
     }
+    bunlink(victim);
+    release(&victimbk->lock);
+    bcache.nevict++;
   }
-  panic("bget: no buffers");
+
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  acquire(&bk->lock);
+  bpush(bk, victim);
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -111,43 +262,188 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
-// Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Return a locked buf for the indicated block, and start
+// reading its contents if they aren't cached, without
+// waiting. Call bwait() before using the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!b->valid)
+    virtio_disk_start(b, 0);
+  return b;
+}
+
+// Start writing b's contents to disk, without waiting.
+// Must be locked. Call bwait() before changing or
+// releasing b.
 void
-brelse(struct buf *b)
+bwrite_async(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
-    panic("brelse");
+    panic("bwrite_async");
+  virtio_disk_start(b, 1);
+}
+
+// Wait for the read or write started on b by bread_async()
+// or bwrite_async(). The first wait of a batch tells the
+// disk about all the requests started before it.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+  b->valid = 1;
+}
+
+// Tell the disk about the requests started so far, for a
+// caller that won't wait for them.
+void
+bkick(void)
+{
+  virtio_disk_kick();
+}
+
+// Start reading a block that is likely to be wanted soon,
+// unless it is already cached, without waiting for it.
+// The buffer stays locked until the read is done; then
+// bdone() releases it.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  b->async = 1;
+  virtio_disk_start(b, 0);
+}
+
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Release a locked buffer.
+// Record when it was last used, for bget()'s LRU eviction.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+  bput(b);
+}
+
+// Called by the disk driver's interrupt when it finishes
+// a read started by breadahead(), whose caller has moved
+// on: release the buffer on its behalf.
+void
+bdone(struct buf *b)
+{
+  b->async = 0;
+  b->valid = 1;
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
+  release(&bk->lock);
+}
+
+// Free up to BRECLAIM of the least recently used unused
+// buffers that a miss added, for when kalloc() runs out of
+// memory. kalloc() calls again while it still needs pages.
+// Returns the number of buffers freed.
+int
+breclaim(void)
+{
+  struct bucket *bk;
+  struct buf *b, *old[BRECLAIM];
+  int i, n, nold;
+
+  // find the oldest, keeping old[] sorted oldest first.
+  // bcache.lock keeps buffers from changing buckets.
+  nold = 0;
+  acquire(&bcache.lock);
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    for(b = bk->head.next; b != &bk->head; b = b->next){
+      if(b->refcnt != 0 || (b >= bcache.buf && b < bcache.buf+NBUF))
+        continue;
+      if(nold == BRECLAIM && b->lastuse >= old[nold-1]->lastuse)
+        continue;
+      if(nold < BRECLAIM)
+        nold++;
+      for(i = nold-1; i > 0 && old[i-1]->lastuse > b->lastuse; i--)
+        old[i] = old[i-1];
+      old[i] = b;
+    }
+    release(&bk->lock);
+  }
+
+  // a lookup may have taken one since.
+  n = 0;
+  for(i = 0; i < nold; i++){
+    b = old[i];
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0){
+      bunlink(b);
+      old[n++] = b;
+    }
+    release(&bk->lock);
+  }
+  bcache.nbuf -= n;
+  bcache.nshrink += n;
   release(&bcache.lock);
+
+  for(i = 0; i < n; i++)
+    buffree(old[i]);
+  return n;
 }
 
+// Report the cache's size and hit rate for the
+// statistics device.
+// Returns the number of characters written to buf.
+int
+bcachestats(char *buf, int sz)
+{
+  struct bucket *bk;
+  uint64 nhit;
 
+  nhit = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    nhit += bk->nhit;
+  return snprintf(buf, sz,
+                  "--- bcache\nbuffers %d hits %lu misses %lu evictions %lu freed %lu\n",
+                  bcache.nbuf, nhit, bcache.nmiss, bcache.nevict, bcache.nshrink);
+}
@@ -1,12 +1,15 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int async;   // release when the disk is done with it?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse; // ticks when refcnt last fell to 0
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *qnext; // next buf in the same disk request
+  uchar *data;  // BSIZE bytes
 };
 
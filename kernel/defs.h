@@ -8,7 +8,7 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
-struct slab;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -17,6 +17,14 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+struct buf*     bread_async(uint, uint);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
+void            bkick(void);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
+int             breclaim(void);
+int             bcachestats(char*, int);
 
 // console.c
 void            consoleinit(void);
@@ -41,6 +49,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   idupexe(struct inode*);
+void            iputexe(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -53,21 +63,53 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
-void            itrunc(struct inode*);
+int             itrunc(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// copyuser.S
+int             copy_user(char*, char*, uint64);
+int             copy_user_str(char*, char*, uint64);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzerofill(void);
 void            kfree(void *);
 void            kinit(void);
-void            slab_init(void);       
-void*           slab_alloc(void);   
-void            slab_free(void *obj); 
+void            kincref(void *);
+int             krefcount(void *);
+int             kallocstats(char*, int);
+void*           kalloc_pages(int);
+void*           kalloc_pages_try(int);
+void            kfree_pages(void*, int);
+int             kfreepages(void);
+
+
+// mmap.c
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmabase(struct proc*);
+uint64          vmamap(struct proc*, uint64, int, int, struct file*, uint);
+int             vmafault(struct proc*, struct vma*, uint64, int);
+int             vmaunmap(struct proc*, uint64, uint64);
+void            vmaunmapall(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcread(struct inode*, uint, uint);
+void            pcinval(struct inode*);
+int             pcreclaim(void);
+
+// kmalloc.c
+void            kmallocinit(void);
+void*           kmalloc(uint);
+void            kmfree(void*);
+int             kmreclaim(void);
+int             kmallocstats(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -106,8 +148,12 @@ void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             waitx(uint64, uint64);
 void            wakeup(void*);
 void            yield(void);
+int             mlfqtick(void);
+int             settickets(int);
+void            mlfqboostall(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -119,9 +165,18 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlocknostat(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+void            freelock(struct spinlock*);
+int             statslock(char*, int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -163,13 +218,24 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(void);
+void            kvmwinreset(struct proc*);
+int             kvmfault(uint64, int, uint64*);
+void            asidinit(void);
+void            uvmswitch(struct proc*);
+void            kvmswitch(void);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(pagetable_t, uint64);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(struct proc*, uint64, int);
+int             vmprefault(struct proc*, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -188,6 +254,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_kick(void);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -26,8 +26,10 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg seg[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -61,6 +63,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > VDSO)
+      goto bad;
+    if((ph.flags & 0x2) == 0 && nseg < NSEG){
+      // read-only: leave the pages to vmfault(), which
+      // reads each one from ip the first time it is used.
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].end = ph.vaddr + ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].perm = flags2perm(ph.flags);
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    // writable data is loaded now, since the kernel may
+    // copyout() to it while holding a spinlock.
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -68,6 +87,8 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
+  if(nseg > 0)
+    exe = idupexe(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -121,12 +142,23 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaunmapall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  kvmwinreset(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldexe = p->exe;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iputexe(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,6 +169,11 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iputexe(exe);
+    end_op();
+  }
   return -1;
 }
 
@@ -4,3 +4,14 @@
 #define O_CREATE  0x200  // Create the file if it does not exist
 #define O_TRUNC   0x400  // Truncate the file to zero length
 #define O_APPEND  0x800  // Append to the end of the file (new flag)
+
+// mmap() protection
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+// mmap() flags
+#define MAP_SHARED    0x01  // Write changes back to the file
+#define MAP_PRIVATE   0x02  // Changes are private to the process
+#define MAP_ANONYMOUS 0x20  // Zero-filled memory, no file
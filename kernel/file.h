@@ -18,8 +18,13 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // References from p->exe: a running program
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one readi() read
+  uint rawin;         // readahead window, in blocks
+  uint raend;         // block after the last one read ahead
+  int npcache;        // pages in the program page cache, under pcache.lock
 
   short type;         // copy of disk inode
   short major;
@@ -38,3 +43,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
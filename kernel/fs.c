@@ -246,31 +246,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *empty, *same;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
+  empty = same = 0;
   for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
+    if(ip->ref == 0 && ip->dev == dev && ip->inum == inum)
+      same = ip;                      // Its old slot.
+    // Remember an empty slot, preferably one
+    // with no cached program pages.
+    if(ip->ref == 0 && (empty == 0 || (empty->npcache && ip->npcache == 0)))
       empty = ip;
   }
 
-  // Recycle an inode entry.
+  // Recycle an inode entry, the inode's own if it is
+  // still there, so that it keeps its cached pages.
+  if(same)
+    empty = same;
   if(empty == 0)
     panic("iget: no inodes");
 
   ip = empty;
+  if(ip != same && ip->npcache)
+    pcinval(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +297,31 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Take a reference to ip for p->exe, the program file a
+// process is running. writei() and itrunc() refuse to
+// change ip until every such reference is dropped with
+// iputexe(), so that pages read in later on a fault
+// match those already mapped.
+struct inode*
+idupexe(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ref++;
+  ip->nexec++;
+  release(&itable.lock);
+  return ip;
+}
+
+// Drop a reference taken by idupexe().
+void
+iputexe(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -420,15 +455,42 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode
+// ip, or 0 if there is none. Unlike bmap(), never allocates.
+static uint
+bmapped(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT && ip->addrs[NDIRECT]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    addr = ((uint*)bp->data)[bn];
+    brelse(bp);
+    return addr;
+  }
+  return 0;
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
-void
+// Returns -1 if ip is a running program.
+int
 itrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
   uint *a;
 
+  if(ip->nexec > 0)
+    return -1;
+  if(ip->type == T_FILE && ip->npcache)
+    pcinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -450,6 +512,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  return 0;
 }
 
 // Copy stat information from inode.
@@ -464,6 +527,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential readahead: a readi() that starts where the
+// previous one left off reads the next rawin blocks ahead
+// of it into the buffer cache, without waiting for them.
+// The window starts at RAMIN blocks and doubles with each
+// sequential read up to RAMAX; any other read closes it.
+#define RAMIN 4
+#define RAMAX 32
+
+// Note that readi() has just read blocks first..last of
+// ip, and start reading the ones after if the reads are
+// sequential. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end, addr;
+
+  if(first == ip->ranext || first + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > RAMAX)
+      ip->rawin = RAMAX;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  end = last + 1 + ip->rawin;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  // skip blocks an earlier call has already started.
+  bn = ip->raend > last + 1 ? ip->raend : last + 1;
+  for(; bn < end; bn++){
+    if((addr = bmapped(ip, bn)) != 0)
+      breadahead(ip->dev, addr);
+  }
+  bkick();
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -492,6 +597,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  if(tot > 0 && tot != -1)
+    readahead(ip, (off - tot) / BSIZE, (off - 1) / BSIZE);
   return tot;
 }
 
@@ -512,6 +619,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec > 0)
+    return -1;
+  if(ip->type == T_FILE && ip->npcache)
+    pcinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
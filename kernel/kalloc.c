@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous blocks of 2^order pages.
 
 #include "types.h"
 #include "param.h"
@@ -16,18 +17,178 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // Only on the buddy lists
 };
 
+// Free memory is managed by a buddy allocator: a block of
+// 2^k pages, aligned to its size, is split into two
+// buddies of 2^(k-1) pages to satisfy smaller requests,
+// and a freed block is merged with its buddy whenever
+// that is free too.
+//
+// So that boot need not touch every page, kinit() only
+// frees the pages up to the first block of the largest
+// order; balloc() adds the rest one such block at a time
+// when it runs out.
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(i) ((struct run*)(KERNBASE + (uint64)(i) * PGSIZE))
+
 struct {
+  struct spinlock lock;
+  struct run *free[MAXORDER+1];  // Free blocks of each order
+  int nfree[MAXORDER+1];
+  uchar order[NPAGE];            // k+1 if the page heads a free block of order k
+  uint64 grow;                   // First page not yet added
+} buddy;
+
+// Single pages are cached on a list per hart, so that harts
+// allocating and freeing at the same time don't contend
+// for one lock. A hart whose list runs dry refills it
+// with a batch of KBATCH pages from the buddy allocator
+// or, if that is empty too, steals half of the longest
+// other hart's list. A hart whose list grows past
+// 2*KBATCH returns a batch.
+#define KBATCH 32
+
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+  uint nsteal;       // Times this hart stole from another
+};
+
+struct kmem kmem[NCPU];
+
+// Pages zeroed ahead of time by idle harts, so that
+// kalloc_zeroed() rarely has to clear a page itself.
+// Pages in the pool have no references.
+#define NZPOOL 128
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+  uint64 nhit;       // kalloc_zeroed() calls served from the pool
+  uint64 nmiss;
+} zpool;
+
+// Reference counts for physical pages, so that a page
+// can be shared copy-on-write between processes after
+// fork(). kfree() only frees a page once the last
+// reference to it is dropped.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+struct {
+  struct spinlock lock;
+  int count[PA2REF(PHYSTOP)];
+} kref;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  char *top;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&buddy.lock, "kmem_buddy");
+  initlock(&zpool.lock, "kmem_zero");
+  initlock(&kref.lock, "kref");
+  if(NPAGE % (1 << MAXORDER) != 0)
+    panic("kinit");
+  top = (char*)(((uint64)end + (PGSIZE << MAXORDER) - 1) & ~((PGSIZE << MAXORDER) - 1));
+  freerange(end, top);
+  buddy.grow = PA2PG(top);
+}
+
+// Add the free block of order k at page i to its list.
+// Caller must hold buddy.lock.
+static void
+bpush(uint64 i, int k)
+{
+  struct run *r = PG2PA(i);
+
+  r->prev = 0;
+  r->next = buddy.free[k];
+  if(r->next)
+    r->next->prev = r;
+  buddy.free[k] = r;
+  buddy.nfree[k]++;
+  buddy.order[i] = k + 1;
+}
+
+// Take the free block of order k at page i off its list.
+// Caller must hold buddy.lock.
+static void
+bremove(uint64 i, int k)
+{
+  struct run *r = PG2PA(i);
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    buddy.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  buddy.nfree[k]--;
+  buddy.order[i] = 0;
+}
+
+// Add the next block of memory that kinit() left out.
+// Returns -1 if there is none. Caller must hold buddy.lock.
+static int
+bgrow(void)
+{
+  if(buddy.grow >= NPAGE)
+    return -1;
+  bpush(buddy.grow, MAXORDER);
+  buddy.grow += 1 << MAXORDER;
+  return 0;
+}
+
+// Allocate a block of order k, splitting a larger one if
+// need be. Returns its first page, or -1.
+// Caller must hold buddy.lock.
+static int
+balloc(int k)
+{
+  uint64 i;
+  int j;
+
+  for(;;){
+    for(j = k; j <= MAXORDER && buddy.free[j] == 0; j++)
+      ;
+    if(j <= MAXORDER)
+      break;
+    if(bgrow() < 0)
+      return -1;
+  }
+  i = PA2PG(buddy.free[j]);
+  bremove(i, j);
+  while(j > k){
+    j--;
+    bpush(i + (1L << j), j);
+  }
+  return i;
+}
+
+// Free the block of order k at page i, merging it
+// with its buddy for as long as that is free.
+// Caller must hold buddy.lock.
+static void
+bfree(uint64 i, int k)
+{
+  uint64 b;
+
+  for(; k < MAXORDER; k++){
+    b = i ^ (1L << k);
+    if(buddy.order[b] != k + 1)
+      break;
+    bremove(b, k);
+    i &= ~(1L << k);
+  }
+  bpush(i, k);
 }
 
 void
@@ -35,31 +196,242 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&buddy.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    bfree(PA2PG(p), 0);
+  release(&buddy.lock);
+}
+
+// Take up to n pages off k's list.
+// Returns them as a chain, with the count in *np.
+static struct run*
+ktake(struct kmem *k, int n, int *np)
+{
+  struct run *head, **rp;
+  int i;
+
+  acquire(&k->lock);
+  head = k->freelist;
+  for(i = 0, rp = &head; i < n && *rp; i++)
+    rp = &(*rp)->next;
+  k->freelist = *rp;
+  *rp = 0;
+  k->nfree -= i;
+  release(&k->lock);
+  *np = i;
+  return head;
+}
+
+// Add a chain of n pages to k's list.
+static void
+kput(struct kmem *k, struct run *head, int n)
+{
+  struct run *tail;
+
+  if(head == 0)
+    return;
+  for(tail = head; tail->next; tail = tail->next)
+    ;
+  acquire(&k->lock);
+  tail->next = k->freelist;
+  k->freelist = head;
+  k->nfree += n;
+  release(&k->lock);
+}
+
+// Return a chain of single pages to the buddy allocator.
+static void
+kputbuddy(struct run *r)
+{
+  struct run *next;
+
+  acquire(&buddy.lock);
+  for(; r; r = next){
+    next = r->next;
+    bfree(PA2PG(r), 0);
+  }
+  release(&buddy.lock);
+}
+
+// Refill hart k's empty list from the buddy allocator
+// or another hart. Returns the number of pages gained.
+static int
+krefill(struct kmem *k)
+{
+  struct kmem *v, *victim;
+  struct run *r, *head;
+  int i;
+  int n;
+
+  head = 0;
+  acquire(&buddy.lock);
+  for(n = 0; n < KBATCH && (i = balloc(0)) >= 0; n++){
+    r = PG2PA(i);
+    r->next = head;
+    head = r;
+  }
+  release(&buddy.lock);
+
+  if(n == 0){
+    // nfree is only a hint here, read without the lock.
+    victim = 0;
+    for(v = kmem; v < &kmem[NCPU]; v++)
+      if(v != k && v->nfree > 0 && (victim == 0 || v->nfree > victim->nfree))
+        victim = v;
+    if(victim == 0)
+      return 0;
+    head = ktake(victim, (victim->nfree + 1) / 2, &n);
+    k->nsteal++;
+  }
+  kput(k, head, n);
+  return n;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Take a page from the zero pool, or return 0.
+static struct run*
+zpop(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.list;
+  if(r){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  if(r)
+    r->next = 0;  // the only non-zero word
+  return r;
+}
+
+// Return every hart's cached pages and the zero pool to
+// the buddy allocator, so that they can merge into larger
+// blocks. Returns the number of pages returned.
+static int
+kdrain(void)
+{
+  struct kmem *k;
+  struct run *r;
+  int n, tot;
+
+  tot = 0;
+  for(k = kmem; k < &kmem[NCPU]; k++){
+    kputbuddy(ktake(k, k->nfree, &n));
+    tot += n;
+  }
+  while((r = zpop()) != 0){
+    kputbuddy(r);
+    tot++;
+  }
+  return tot;
+}
+
+// Add a reference to the page at pa, which must
+// have been returned by kalloc().
+void
+kincref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kref.lock);
+  if(kref.count[PA2REF(pa)] < 1)
+    panic("kincref: free page");
+  kref.count[PA2REF(pa)]++;
+  release(&kref.lock);
+}
+
+// Return the number of references to the page at pa.
+int
+krefcount(void *pa)
+{
+  int n;
+
+  acquire(&kref.lock);
+  n = kref.count[PA2REF(pa)];
+  release(&kref.lock);
+  return n;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kmem *k;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kref.lock);
+  if((n = --kref.count[PA2REF(pa)]) < 0)
+    panic("kfree: ref");
+  release(&kref.lock);
+  if(n > 0)
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  k = &kmem[cpuid()];
+  acquire(&k->lock);
+  r->next = k->freelist;
+  k->freelist = r;
+  k->nfree++;
+  n = k->nfree;
+  release(&k->lock);
+  if(n > 2*KBATCH){
+    batch = ktake(k, KBATCH, &n);
+    kputbuddy(batch);
+  }
+  pop_off();
+}
+
+// Take a free page from this hart's list, refilling it
+// if need be. Returns 0 if there are no free pages.
+static struct run*
+kget(void)
+{
+  struct run *r;
+  struct kmem *k;
+
+  push_off();
+  k = &kmem[cpuid()];
+  do {
+    acquire(&k->lock);
+    r = k->freelist;
+    if(r){
+      k->freelist = r->next;
+      k->nfree--;
+    }
+    release(&k->lock);
+  } while(r == 0 && krefill(k) > 0);
+  pop_off();
+  return r;
+}
+
+// Out of memory: evict cached program pages that no
+// process maps and unused disk buffers, then free the
+// kmalloc() slabs that left empty.
+// Returns 0 if nothing could be freed.
+static int
+kreclaim(void)
+{
+  int n;
+
+  n = pcreclaim();
+  n += breclaim();
+  n += kmreclaim();
+  return n;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,67 +442,190 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  // out of memory: retry after emptying the caches,
+  // and finally fall back on the zero pool.
+  while((r = kget()) == 0){
+    if(kreclaim() == 0){
+      r = zpop();
+      break;
+    }
+  }
 
-  if(r)
+  if(r){
+    kref.count[PA2REF(r)] = 1;
+#ifdef KALLOC_JUNK
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
 
-// Slab Allocation implementation
+// Allocate one page of physical memory filled with zeros,
+// preferably from the pool that idle harts fill.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
 
-#define MAX_SLOTS 64    // Maximum slots per slab
-#define OBJECT_SIZE 64  // Example: size of the object (adjust as needed)
+  if((r = zpop()) != 0){
+    kref.count[PA2REF(r)] = 1;
+    __sync_fetch_and_add(&zpool.nhit, 1);
+    return (void*)r;
+  }
+  __sync_fetch_and_add(&zpool.nmiss, 1);
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
 
-// Slab structure
-struct slab {
-    void *slots[MAX_SLOTS];  // Freelist of reusable slots
-    int used_slots;          // Number of used slots
-    struct spinlock lock;    // Lock for thread safety
-};
+// Zero a free page for the pool; called by the scheduler
+// on a hart with nothing to run. Returns 0 if there was
+// nothing to do, because the pool is full or free pages
+// are scarce.
+int
+kzerofill(void)
+{
+  struct run *r;
 
-// Example slab for fixed-size objects
-struct slab object_slab;
+  // zpool.n is only a hint here, read without the lock.
+  if(zpool.n >= NZPOOL || (r = kget()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+  acquire(&zpool.lock);
+  r->next = zpool.list;
+  zpool.list = r;
+  zpool.n++;
+  release(&zpool.lock);
+  return 1;
+}
 
-// Initialize the slab
-void slab_init() {
-    initlock(&object_slab.lock, "object_slab");
-    object_slab.used_slots = 0;
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. If reclaim, empty the caches to make a
+// block of that size if there is none.
+static void *
+kallocblock(int order, int reclaim)
+{
+  int i;
+  int j;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  for(;;){
+    acquire(&buddy.lock);
+    i = balloc(order);
+    release(&buddy.lock);
+    if(i >= 0)
+      break;
+    // pages cached by the harts, by pcache, by the buffer
+    // cache or by kmalloc() may be keeping smaller blocks
+    // from merging.
+    if(!reclaim || (kdrain() == 0 && kreclaim() == 0))
+      return 0;
+  }
+
+  for(j = 0; j < (1 << order); j++)
+    kref.count[i + j] = 1;
+#ifdef KALLOC_JUNK
+  memset((char*)PG2PA(i), 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)PG2PA(i);
 }
 
-// Allocate an object from the slab
-void *slab_alloc() {
-    acquire(&object_slab.lock);
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns a pointer that the kernel can
+// use, or 0 if there is no free block that large.
+void *
+kalloc_pages(int order)
+{
+  return kallocblock(order, 1);
+}
 
-    if (object_slab.used_slots > 0) {
-        // Reuse a previously freed slot
-        void *obj = object_slab.slots[--object_slab.used_slots];
-        release(&object_slab.lock);
-        return obj;
-    }
+// Like kalloc_pages(), but give up at once rather than
+// empty the caches, for callers that can make do with
+// single pages.
+void *
+kalloc_pages_try(int order)
+{
+  return kallocblock(order, 0);
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 i;
+  int j;
 
-    release(&object_slab.lock);
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
 
-    // Fallback to general allocator if slab is empty
-    return kalloc();
+  i = PA2PG(pa);
+  for(j = 0; j < (1 << order); j++)
+    kref.count[i + j] = 0;
+#ifdef KALLOC_JUNK
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&buddy.lock);
+  bfree(i, order);
+  release(&buddy.lock);
 }
 
-// Free an object back to the slab
-void slab_free(void *obj) {
-    acquire(&object_slab.lock);
+// Return the number of free pages, counting those not yet
+// added. Read without locks, so only a hint.
+int
+kfreepages(void)
+{
+  int i, k, n;
 
-    if (object_slab.used_slots < MAX_SLOTS) {
-        // Add the object back to the freelist
-        object_slab.slots[object_slab.used_slots++] = obj;
-        release(&object_slab.lock);
-    } else {
-        release(&object_slab.lock);
-        // Fallback to general free if slab is full
-        kfree(obj);
-    }
+  n = NPAGE - buddy.grow;
+  for(k = 0; k <= MAXORDER; k++)
+    n += buddy.nfree[k] << k;
+  for(i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  return n;
 }
 
+// Report free memory for the statistics device: the
+// pages cached by each hart, and the buddy allocator's
+// free blocks of each order with the fraction of free
+// memory that is in smaller blocks and so unusable for
+// an allocation of that order.
+// Returns the number of characters written to buf.
+int
+kallocstats(char *buf, int sz)
+{
+  int i, k, n, cached, free, small;
+
+  n = snprintf(buf, sz, "--- kalloc free pages\n");
+  cached = 0;
+  for(i = 0; i < NCPU; i++){
+    cached += kmem[i].nfree;
+    if(kmem[i].nfree || kmem[i].nsteal)
+      n += snprintf(buf+n, sz-n, "cpu %d: free %d steals %u\n",
+                    i, kmem[i].nfree, kmem[i].nsteal);
+  }
+
+  acquire(&buddy.lock);
+  free = cached;
+  for(k = 0; k <= MAXORDER; k++)
+    free += buddy.nfree[k] << k;
+  n += snprintf(buf+n, sz-n, "zero pool: %d pages, hits %lu misses %lu\n",
+                zpool.n, zpool.nhit, zpool.nmiss);
+  n += snprintf(buf+n, sz-n, "buddy: free %d pages, %d not yet added\n",
+                free, (int)(NPAGE - buddy.grow));
+  // small counts the free pages in blocks of order < k.
+  small = 0;
+  for(k = 0; k <= MAXORDER; k++){
+    n += snprintf(buf+n, sz-n, "order %d: %d blocks, unusable %d%%\n",
+                  k, buddy.nfree[k], free ? small * 100 / free : 0);
+    small += buddy.nfree[k] << k;
+    if(k == 0)
+      small += cached;
+  }
+  release(&buddy.lock);
+  return n;
+}
@@ -0,0 +1,342 @@
+//
+// Allocator for kernel objects smaller than a page:
+// kmalloc() and kmfree().
+//
+// Requests are rounded up to a power-of-two size class,
+// from 16 to 2048 bytes. Each class has a cache of slabs:
+// blocks from kalloc_pages() with a struct slab at the
+// start and the rest carved into objects aligned to their
+// size. A slab is one page, or a larger block for the
+// biggest classes so that it still holds several objects.
+// slabclass[] records the class of the slab each page
+// belongs to, so that kmfree() can find an object's slab
+// from its address alone.
+//
+// In front of each cache, every hart keeps a magazine of
+// objects, so that most kmalloc() and kmfree() calls only
+// take the hart's own, uncontended magazine lock. A hart
+// refills an empty magazine, or drains a full one, by half
+// a magazine at a time under the cache's lock.
+//
+// A slab that becomes empty is freed, unless it is the
+// cache's only partially used slab. kmreclaim() empties
+// the magazines and frees every empty slab, for when
+// kalloc() runs out of memory.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCLASS 8             // 16 bytes << 0..7
+#define MAGSIZE 16           // objects per magazine
+
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+struct slab {
+  struct slab *next;         // On the cache's partial list
+  struct slab *prev;
+  void *free;                // Free objects in this slab
+  int inuse;                 // Objects handed out
+};
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+  uint64 nalloc;             // kmalloc() calls on this hart
+  uint64 nfree;              // kmfree() calls on this hart
+};
+
+struct kmcache {
+  struct spinlock lock;
+  uint size;                 // Object size
+  int order;                 // Slabs are 2^order pages
+  int off;                   // Offset of the first object in a slab
+  int perslab;               // Objects per slab
+  struct slab *partial;      // Slabs with free objects
+  int nslab;
+  int inuse;                 // Objects out of slabs, incl. in magazines
+  struct magazine mag[NCPU];
+} kmcache[NCLASS];
+
+static uchar slabclass[PA2PG(PHYSTOP)];  // class+1 of each slab page
+
+void
+kmallocinit(void)
+{
+  struct kmcache *c;
+  int i;
+
+  for(c = kmcache; c < &kmcache[NCLASS]; c++){
+    initlock(&c->lock, "kmalloc");
+    c->size = 16 << (c - kmcache);
+    c->off = sizeof(struct slab);
+    if(c->off % c->size)
+      c->off = c->off + c->size - c->off % c->size;
+    c->order = 0;
+    while(((PGSIZE << c->order) - c->off) / c->size < 4)
+      c->order++;
+    c->perslab = ((PGSIZE << c->order) - c->off) / c->size;
+    for(i = 0; i < NCPU; i++)
+      initlock(&c->mag[i].lock, "kmalloc_mag");
+  }
+}
+
+static void
+partialpush(struct kmcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+partialremove(struct kmcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Add a new slab to c. Returns -1 if out of memory.
+static int
+newslab(struct kmcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = kalloc_pages(c->order)) == 0)
+    return -1;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (char*)s + c->off + i * c->size;
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  for(i = 0; i < (1 << c->order); i++)
+    slabclass[PA2PG(s) + i] = c - kmcache + 1;
+
+  acquire(&c->lock);
+  partialpush(c, s);
+  c->nslab++;
+  release(&c->lock);
+  return 0;
+}
+
+// Free an empty slab of c, which is on no list.
+static void
+freeslab(struct kmcache *c, struct slab *s)
+{
+  int i;
+
+  for(i = 0; i < (1 << c->order); i++)
+    slabclass[PA2PG(s) + i] = 0;
+  kfree_pages(s, c->order);
+}
+
+// Take up to n objects from c's slabs into obj[].
+// Returns how many it took. Caller must hold c->lock.
+static int
+slaballoc(struct kmcache *c, void **obj, int n)
+{
+  struct slab *s;
+  int i;
+
+  for(i = 0; i < n && (s = c->partial) != 0; i++){
+    obj[i] = s->free;
+    s->free = *(void**)s->free;
+    s->inuse++;
+    c->inuse++;
+    if(s->free == 0)
+      partialremove(c, s);
+  }
+  return i;
+}
+
+// Return object o to its slab. If that leaves the slab
+// empty and keep is 0 or another slab has free objects,
+// take the slab off c and add it to *empty for the caller
+// to free with freeslab(). Caller must hold c->lock.
+static void
+slabfree(struct kmcache *c, void *o, int keep, struct slab **empty)
+{
+  struct slab *s;
+
+  s = (struct slab*)((uint64)o & ~((PGSIZE << c->order) - 1));
+  if(s->free == 0)
+    partialpush(c, s);
+  *(void**)o = s->free;
+  s->free = o;
+  s->inuse--;
+  c->inuse--;
+  if(s->inuse == 0 && (!keep || s != c->partial || s->next)){
+    partialremove(c, s);
+    c->nslab--;
+    s->next = *empty;
+    *empty = s;
+  }
+}
+
+// Allocate n bytes, at most 2048, aligned to the
+// power of two n is rounded up to.
+// Returns 0 if out of memory.
+void*
+kmalloc(uint n)
+{
+  struct kmcache *c;
+  struct magazine *m;
+  void *o;
+  int k;
+
+  for(k = 0; k < NCLASS && (16 << k) < n; k++)
+    ;
+  if(k == NCLASS)
+    panic("kmalloc: too big");
+  c = &kmcache[k];
+
+  for(;;){
+    push_off();
+    m = &c->mag[cpuid()];
+    acquire(&m->lock);
+    if(m->n == 0){
+      acquire(&c->lock);
+      m->n = slaballoc(c, m->obj, MAGSIZE / 2);
+      release(&c->lock);
+    }
+    if(m->n > 0)
+      break;
+    release(&m->lock);
+    pop_off();
+    if(newslab(c) < 0)
+      return 0;
+  }
+  o = m->obj[--m->n];
+  m->nalloc++;
+  release(&m->lock);
+  pop_off();
+
+#ifdef KALLOC_JUNK
+  memset(o, 5, c->size); // fill with junk
+#endif
+  return o;
+}
+
+// Free an object returned by kmalloc().
+void
+kmfree(void *o)
+{
+  struct kmcache *c;
+  struct magazine *m;
+  struct slab *s, *empty;
+  uint64 pg;
+
+  pg = PA2PG(o);
+  if((uint64)o < KERNBASE || (uint64)o >= PHYSTOP || slabclass[pg] == 0)
+    panic("kmfree");
+  c = &kmcache[slabclass[pg] - 1];
+
+#ifdef KALLOC_JUNK
+  // Fill with junk to catch dangling refs.
+  memset(o, 1, c->size);
+#endif
+
+  empty = 0;
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slabfree(c, m->obj[--m->n], 1, &empty);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  m->nfree++;
+  release(&m->lock);
+  pop_off();
+
+  for(; empty; empty = s){
+    s = empty->next;
+    freeslab(c, empty);
+  }
+}
+
+// Empty every magazine and free every empty slab.
+// Returns the number of pages freed.
+int
+kmreclaim(void)
+{
+  struct kmcache *c;
+  struct magazine *m;
+  struct slab *s, *next, *empty;
+  int n;
+
+  n = 0;
+  for(c = kmcache; c < &kmcache[NCLASS]; c++){
+    empty = 0;
+    for(m = c->mag; m < &c->mag[NCPU]; m++){
+      acquire(&m->lock);
+      acquire(&c->lock);
+      while(m->n > 0)
+        slabfree(c, m->obj[--m->n], 0, &empty);
+      release(&c->lock);
+      release(&m->lock);
+    }
+    // an empty slab kept by an earlier kmfree().
+    acquire(&c->lock);
+    for(s = c->partial; s; s = next){
+      next = s->next;
+      if(s->inuse == 0){
+        partialremove(c, s);
+        c->nslab--;
+        s->next = empty;
+        empty = s;
+      }
+    }
+    release(&c->lock);
+    for(; empty; empty = s){
+      s = empty->next;
+      freeslab(c, empty);
+      n += 1 << c->order;
+    }
+  }
+  return n;
+}
+
+// Report each cache's use for the statistics device.
+// Returns the number of characters written to buf.
+int
+kmallocstats(char *buf, int sz)
+{
+  struct kmcache *c;
+  struct magazine *m;
+  uint64 nalloc, nfree;
+  int n, cached;
+
+  n = snprintf(buf, sz, "--- kmalloc caches\n");
+  for(c = kmcache; c < &kmcache[NCLASS]; c++){
+    cached = 0;
+    nalloc = nfree = 0;
+    for(m = c->mag; m < &c->mag[NCPU]; m++){
+      cached += m->n;
+      nalloc += m->nalloc;
+      nfree += m->nfree;
+    }
+    n += snprintf(buf+n, sz-n,
+                  "kmalloc-%d: slabs %d objs %d/%d magazines %d allocs %lu frees %lu\n",
+                  c->size, c->nslab, c->inuse - cached, c->nslab * c->perslab,
+                  cached, nalloc, nfree);
+  }
+  return n;
+}
@@ -69,16 +69,26 @@ static void
 install_trans(int recovering)
 {
   int tail;
+  struct buf *lbuf[LOGSIZE], *dbuf[LOGSIZE];
 
+  // start all the reads, then all the writes, so that
+  // each goes to the disk as one batch.
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    lbuf[tail] = bread_async(log.dev, log.start+tail+1); // read log block
+    dbuf[tail] = bread_async(log.dev, log.lh.block[tail]); // read dst
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(lbuf[tail]);
+    bwait(dbuf[tail]);
+    memmove(dbuf[tail]->data, lbuf[tail]->data, BSIZE);  // copy block to dst
+    bwrite_async(dbuf[tail]);  // write dst to disk
+    brelse(lbuf[tail]);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -179,14 +189,21 @@ static void
 write_log(void)
 {
   int tail;
+  struct buf *to[LOGSIZE];
 
+  // as in install_trans(), batch the reads and the writes.
+  for (tail = 0; tail < log.lh.n; tail++)
+    to[tail] = bread_async(log.dev, log.start+tail+1); // log block
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    bwait(to[tail]);
+    memmove(to[tail]->data, from->data, BSIZE);
+    bwrite_async(to[tail]);  // write the log
     brelse(from);
-    brelse(to);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
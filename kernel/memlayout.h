@@ -17,6 +17,10 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// qemu's virt machine advances the time CSR
+// at 10 MHz on every hart.
+#define TIMEBASE 10000000L
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -47,6 +51,12 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// each process's kernel page table maps its user memory
+// again in the upper half of the address space, where
+// user address va is at UWINDOW+va (0xffffffc000000000
+// is -MAXVA, sign-extended as Sv39 requires).
+#define UWINDOW (-MAXVA)
+
 // User memory layout.
 // Address zero first:
 //   text
@@ -54,6 +64,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   VDSO (p->vdso, read-only data for user code)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VDSO (TRAPFRAME - PGSIZE)
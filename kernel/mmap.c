@@ -0,0 +1,305 @@
+//
+// Memory regions created by mmap(): anonymous memory
+// and files, shared or private.
+//
+// Pages are read in by vmafault() when first touched.
+// Dirty pages (PTE_D) of a MAP_SHARED file mapping are
+// written back to the file, through the log, when the
+// region is unmapped, including at exit() and exec().
+// Regions are placed top-down below the VDSO page, and
+// sbrk() may not grow the heap into the lowest of them.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Return p's region containing va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the lowest address of any region,
+// which bounds the growth of p's heap.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = VDSO;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Find len bytes of unused address space between
+// the heap and VDSO, as high as possible.
+// Returns 0 if there is none.
+static uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 top = VDSO;
+
+ again:
+  if(top < len || top - len < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start && v->start < top && v->end > top - len){
+      top = v->start;
+      goto again;
+    }
+  }
+  return top - len;
+}
+
+// Create a region of len bytes in p. f, if not 0, has
+// already been checked against prot and flags.
+// Returns the region's address, or -1.
+uint64
+vmamap(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v;
+  uint64 va;
+
+  len = PGROUNDUP(len);
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start == 0)
+      break;
+  if(v == &p->vma[NVMA] || (va = vmaplace(p, len)) == 0)
+    return -1;
+
+  v->start = va;
+  v->end = va + len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  return va;
+}
+
+// Read in or allocate the page at page-aligned va in
+// region v, on a fault or for copyin()/copyout().
+// Returns 0 on success, -1 if the access is not allowed
+// or memory is exhausted.
+int
+vmafault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip;
+  char *mem;
+  int perm;
+
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if(v->prot == PROT_NONE)
+    return -1;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(v->f){
+    // bytes past the end of the file read as zero.
+    ip = v->f->ip;
+    ilock(ip);
+    if(readi(ip, 0, (uint64)mem, v->off + (va - v->start), PGSIZE) < 0){
+      iunlock(ip);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(ip);
+  }
+
+  perm = PTE_U | PTE_R | PTE_A;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(write)
+    perm |= PTE_D;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  uvmflush(p->pagetable, va);
+  return 0;
+}
+
+// Write the page at pa back to offset off of ip,
+// without extending the file.
+// Returns 0 on success, -1 if a write fails or is short,
+// e.g. because ip is a running program.
+static int
+vmawritepage(struct inode *ip, uint64 pa, uint off)
+{
+  // at most this many bytes per transaction,
+  // as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(n > ip->size - (off + i))
+      n = ip->size - (off + i);
+    if(writei(ip, 0, pa + i, off + i, n) != n){
+      iunlock(ip);
+      end_op();
+      return -1;
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return 0;
+}
+
+// Unmap [a, b) of region v, writing dirty pages of
+// a shared file mapping back to the file first.
+// Returns -1 if any page could not be written back,
+// though the range is unmapped anyway.
+static int
+vmaunmaprange(struct proc *p, struct vma *v, uint64 a, uint64 b)
+{
+  uint64 va;
+  pte_t *pte;
+  int r = 0;
+
+  if(v->f && (v->flags & MAP_SHARED)){
+    for(va = a; va < b; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D) &&
+         vmawritepage(v->f->ip, PTE2PA(*pte), v->off + (va - v->start)) < 0)
+        r = -1;
+    }
+  }
+  uvmunmap(p->pagetable, a, (b - a) / PGSIZE, 1);
+  return r;
+}
+
+// Unmap [addr, addr+len) from p, shrinking, splitting
+// or removing the regions it overlaps.
+// Returns 0 on success, -1 on a bad argument or if a
+// region would have to be split with no free slot, in
+// which case nothing is unmapped, or if a dirty page of a
+// shared mapping could not be written back to its file.
+int
+vmaunmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *nv;
+  uint64 a, b;
+  int r = 0;
+
+  a = addr;
+  b = PGROUNDUP(addr + len);
+  if(a % PGSIZE != 0 || len == 0 || b <= a)
+    return -1;
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0 && nv == 0)
+      nv = v;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start && v->start < a && v->end > b && nv == 0)
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0 || v->end <= a || v->start >= b)
+      continue;
+    uint64 lo = a > v->start ? a : v->start;
+    uint64 hi = b < v->end ? b : v->end;
+    if(vmaunmaprange(p, v, lo, hi) < 0)
+      r = -1;
+    if(lo == v->start && hi == v->end){
+      if(v->f)
+        fileclose(v->f);
+      v->start = v->end = 0;
+      v->f = 0;
+    } else if(lo == v->start){
+      v->off += hi - v->start;
+      v->start = hi;
+    } else if(hi == v->end){
+      v->end = lo;
+    } else {
+      // a hole in the middle: the part above it
+      // becomes a new region.
+      *nv = *v;
+      nv->off += hi - v->start;
+      nv->start = hi;
+      if(nv->f)
+        filedup(nv->f);
+      v->end = lo;
+    }
+  }
+  return r;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+vmaunmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && vmaunmap(p, v->start, v->end - v->start) < 0)
+      printf("pid %d: lost a write to a shared mapping\n", p->pid);
+}
+
+// Give child np a copy of p's regions for fork().
+// Shared regions map the same pages in both, private
+// ones copy-on-write. Called with np->lock held, so on
+// failure this undoes its work without sleeping: np's
+// file references can't be the last ones.
+// Returns 0 on success, -1 on failure.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0)
+      continue;
+    if(uvmcopy(p->pagetable, np->pagetable, v->start, v->end,
+               (v->flags & MAP_SHARED) == 0) < 0)
+      goto err;
+    np->vma[v - p->vma] = *v;
+    if(v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ err:
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->start == 0)
+      continue;
+    uvmunmap(np->pagetable, nv->start, (nv->end - nv->start) / PGSIZE, 1);
+    if(nv->f)
+      fileclose(nv->f);
+    nv->start = nv->end = 0;
+    nv->f = 0;
+  }
+  return -1;
+}
@@ -8,8 +8,16 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // never-freed part of disk block cache
+#define NBUFMAX      4096  // maximum size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NMLFQ        3     // number of scheduler priority levels
+#define MLFQBOOST    50    // ticks between priority boosts
+#define NTICKETS     100   // default stride scheduling tickets per process
+#define NSEG         4     // demand-paged ELF segments per process
+#define NPCACHE      256   // cached read-only program pages
+#define NVMA         16    // mmap() regions per process
+#define MAXORDER     10    // largest kalloc_pages() block is 2^MAXORDER pages
 
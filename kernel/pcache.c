@@ -0,0 +1,207 @@
+// Cache of read-only program pages, so that processes
+// running the same binary share its text instead of each
+// reading a private copy from disk.
+//
+// A cached page is identified by the file's device and
+// inode number and by the offset and length of the part
+// of the file read into it; the rest of the page is zero.
+//
+// The cache holds one kalloc() reference to each page and
+// every user mapping holds another, so uvmunmap() frees a
+// page only once it is also evicted. kalloc() calls
+// pcreclaim() to evict pages that no process maps when
+// memory runs out.
+//
+// writei() and itrunc() drop a file's pages from the
+// cache; processes that already map them keep the old
+// contents. Pages are inserted with the inode locked, so
+// a concurrent write cannot leave a stale page behind.
+// Each cached page points to its file's in-memory inode,
+// which counts them in ip->npcache, so that writes to the
+// many files with no cached pages need not search the
+// cache. iget() drops an inode's pages before it reuses
+// the inode's slot for another file.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NBUCKET 61
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;                    // File offset of the page
+  uint n;                      // Bytes read from the file
+  char *pa;                    // 0 if this slot is free
+  struct inode *ip;            // Counts this page in ip->npcache
+  uint lastuse;                // pcache.clock at last lookup
+  struct pcpage *next;         // Hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *bucket[NBUCKET];
+  uint clock;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct pcpage**
+pchash(uint dev, uint inum, uint off)
+{
+  return &pcache.bucket[(dev*31 + inum*131 + off/PGSIZE) % NBUCKET];
+}
+
+// Find a cached page. Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(uint dev, uint inum, uint off, uint n)
+{
+  struct pcpage *pg;
+
+  for(pg = *pchash(dev, inum, off); pg; pg = pg->next){
+    if(pg->dev == dev && pg->inum == inum && pg->off == off && pg->n == n){
+      pg->lastuse = ++pcache.clock;
+      return pg;
+    }
+  }
+  return 0;
+}
+
+// Evict pg, dropping the cache's reference to its page.
+// Caller must hold pcache.lock.
+static void
+pcremove(struct pcpage *pg)
+{
+  struct pcpage **pp;
+
+  for(pp = pchash(pg->dev, pg->inum, pg->off); *pp != pg; pp = &(*pp)->next)
+    ;
+  *pp = pg->next;
+  pg->ip->npcache--;
+  kfree(pg->pa);
+  pg->pa = 0;
+  pg->ip = 0;
+}
+
+// Cache mem, evicting the least recently used page if
+// the cache is full. Caller must hold pcache.lock.
+static void
+pcinsert(struct inode *ip, uint off, uint n, char *mem)
+{
+  struct pcpage *pg, *victim, **b;
+
+  victim = 0;
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa == 0){
+      victim = pg;
+      break;
+    }
+    if(victim == 0 || pg->lastuse < victim->lastuse)
+      victim = pg;
+  }
+  if(victim->pa)
+    pcremove(victim);
+
+  kincref(mem);
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->ip = ip;
+  ip->npcache++;
+  victim->off = off;
+  victim->n = n;
+  victim->pa = mem;
+  victim->lastuse = ++pcache.clock;
+  b = pchash(ip->dev, ip->inum, off);
+  victim->next = *b;
+  *b = victim;
+}
+
+// Return a page holding n bytes of ip starting at file
+// offset off, followed by zeros, with a reference for the
+// caller to map read-only. Reads the page from ip and
+// caches it if it is not already cached.
+// ip must not be locked. Returns 0 if memory is
+// exhausted or the read fails.
+char*
+pcread(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *pg;
+  char *mem;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip->dev, ip->inum, off, n)) != 0){
+    mem = pg->pa;
+    kincref(mem);
+    release(&pcache.lock);
+    return mem;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip->dev, ip->inum, off, n)) != 0){
+    // another process read it in first.
+    kfree(mem);
+    mem = pg->pa;
+    kincref(mem);
+  } else {
+    pcinsert(ip, off, n, mem);
+  }
+  release(&pcache.lock);
+  iunlock(ip);
+  return mem;
+}
+
+// Drop ip's pages from the cache because its contents
+// are changing or its slot is being reused. Caller must
+// hold ip->lock, or ip must have no references.
+void
+pcinval(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE] && ip->npcache > 0; pg++)
+    if(pg->pa && pg->ip == ip)
+      pcremove(pg);
+  release(&pcache.lock);
+}
+
+// Evict every cached page that no process maps.
+// Returns the number of pages freed.
+int
+pcreclaim(void)
+{
+  struct pcpage *pg;
+  int n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa && krefcount(pg->pa) == 1){
+      pcremove(pg);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
@@ -5,11 +5,72 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "rusage.h"
+#include "vdso.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+// Per-CPU run queues. Each holds only RUNNABLE processes,
+// linked through p->rqnext, in one list per MLFQ priority
+// level. The lowest non-empty level runs first. Within a
+// level, the list is kept sorted by stride pass, so
+// processes get CPU time in proportion to their tickets;
+// equal passes are served FIFO.
+// A process is on at most one run queue,
+// and only while it is RUNNABLE.
+// An idle CPU steals from the busiest peer's queue. Every
+// BALANCE ticks a CPU also takes a process from a peer
+// whose queue is further behind than its own, so that a
+// process's share doesn't depend on which CPU it is on.
+// A run queue's lock may be acquired while holding a p->lock,
+// but not the other way around.
+struct runq {
+  struct spinlock lock;
+  struct {
+    struct proc *head;
+    struct proc *tail;
+    uint64 pass;          // pass of the last process taken from here
+  } level[NMLFQ];
+  int n;                  // number of queued processes
+  uint boost;             // mlfqboost when the levels were last merged
+  uint balanced;          // ticks when this CPU last balanced
+} runqs[NCPU];
+
+// Bumped every MLFQBOOST ticks. A process or run queue that
+// has not yet seen the current value still has to be moved
+// back to the top priority level.
+uint mlfqboost;
+
+// Wait queues. A sleeping process is linked on the wait queue
+// its channel hashes to, so that wakeup(chan) only has to look
+// at processes that might be sleeping on chan, rather than at
+// the whole process table.
+// A wait queue's lock is acquired before any p->lock.
+#define NWAITQ 64
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitqs[NWAITQ];
+
+// Ticks a process may run at a priority level before
+// it is demoted to the next one.
+#define QUANTUM(level) (1 << (level))
+
+// A process's stride is STRIDE1 / its tickets; its pass
+// advances by its stride for every tick it runs.
+#define STRIDE1 (1L << 20)
+
+// How far, in pass, a peer's queue may fall behind this
+// CPU's before balancing takes a process from it: a few
+// ticks of a process with the default tickets.
+#define STEALSLACK (4 * STRIDE1 / NTICKETS)
+
+// Ticks between a CPU's looks at its peers' queues.
+#define BALANCE 10
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -19,6 +80,7 @@ extern void forkret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -26,23 +88,46 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
+// Bumped whenever a kernel stack is mapped, so that each
+// hart knows to flush its TLB before running on it.
+uint kstackgen;
+
+// Allocate the page-table pages for each process's kernel
+// stack, high in memory and followed by an invalid guard
+// page. The stacks themselves are allocated and mapped by
+// proc_mapstack() when their slot is first used, and
+// setting a PTE then needs no lock.
 void
 proc_mapstacks(pagetable_t kpgtbl)
 {
   struct proc *p;
   
   for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+    if(walk(kpgtbl, KSTACK((int) (p - proc)), 1) == 0)
+      panic("proc_mapstacks");
   }
 }
 
+// Give p a kernel stack, unless it already has one from
+// an earlier use of its slot. Stacks are never unmapped.
+// Returns 0 on success, -1 if memory is exhausted.
+static int
+proc_mapstack(struct proc *p)
+{
+  pte_t *pte;
+  char *pa;
+
+  pte = walk(kernel_pagetable, p->kstack, 0);
+  if(*pte & PTE_V)
+    return 0;
+  if((pa = kalloc()) == 0)
+    return -1;
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+  sfence_vma();
+  __sync_fetch_and_add(&kstackgen, 1);
+  return 0;
+}
+
 // initialize the proc table.
 void
 procinit(void)
@@ -51,6 +136,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -102,6 +191,195 @@ allocpid()
   return pid;
 }
 
+// Insert p into rq's list for priority level l, after
+// every process with the same or a lower pass.
+// Caller must hold rq->lock.
+static void
+rqinsert(struct runq *rq, int l, struct proc *p)
+{
+  struct proc **pp;
+
+  pp = &rq->level[l].head;
+  while(*pp && (*pp)->pass <= p->pass)
+    pp = &(*pp)->rqnext;
+  p->rqnext = *pp;
+  *pp = p;
+  if(p->rqnext == 0)
+    rq->level[l].tail = p;
+}
+
+// Queue p on its CPU's run queue, at its priority level.
+// woke says whether p has just stopped sleeping, in which
+// case its pass is raised to that of the last process taken
+// from its level, the lowest there was: it must not be able
+// to monopolize the level to catch up on its sleep, nor
+// wait behind processes that are further behind than it.
+// Caller must hold p->lock and have set p->state to RUNNABLE.
+static void
+rqpush(struct proc *p, int woke)
+{
+  struct runq *rq = &runqs[p->cpu];
+
+  if(!holding(&p->lock) || p->state != RUNNABLE)
+    panic("rqpush");
+
+  if(p->boost != mlfqboost){
+    p->boost = mlfqboost;
+    p->level = 0;
+    p->qticks = 0;
+  }
+
+  acquire(&rq->lock);
+  if(woke && p->pass < rq->level[p->level].pass)
+    p->pass = rq->level[p->level].pass;
+  rqinsert(rq, p->level, p);
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Move every queued process up to the top level.
+// Caller must hold rq->lock.
+static void
+rqboost(struct runq *rq)
+{
+  struct proc *p;
+
+  for(int l = 1; l < NMLFQ; l++){
+    while((p = rq->level[l].head) != 0){
+      rq->level[l].head = p->rqnext;
+      rqinsert(rq, 0, p);
+    }
+    rq->level[l].tail = 0;
+  }
+  rq->boost = mlfqboost;
+}
+
+// Return the lowest level of rq with a process queued,
+// or -1 if rq is empty. Called without rq->lock only as a
+// hint: the procs are never freed, but may have moved.
+static int
+rqlevel(struct runq *rq)
+{
+  for(int l = 0; l < NMLFQ; l++)
+    if(rq->level[l].head)
+      return l;
+  return -1;
+}
+
+// Remove and return the first process on rq's list for
+// level l, which must not be empty. Caller must hold rq->lock.
+static struct proc*
+rqtake(struct runq *rq, int l)
+{
+  struct proc *p;
+
+  p = rq->level[l].head;
+  rq->level[l].head = p->rqnext;
+  if(rq->level[l].head == 0)
+    rq->level[l].tail = 0;
+  rq->n--;
+  p->rqnext = 0;
+  return p;
+}
+
+// Remove and return the highest-priority process on rq
+// with the lowest pass, or 0 if rq is empty.
+// The caller must not hold any p->lock.
+static struct proc*
+rqpop(struct runq *rq)
+{
+  struct proc *p = 0;
+  int l;
+
+  // unlocked peek, so that idle CPUs don't bounce
+  // the locks of empty queues between them.
+  if(rq->n == 0)
+    return 0;
+
+  acquire(&rq->lock);
+  if(rq->boost != mlfqboost)
+    rqboost(rq);
+  if((l = rqlevel(rq)) >= 0){
+    p = rqtake(rq, l);
+    rq->level[l].pass = p->pass;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Take a RUNNABLE process from the busiest other CPU's
+// run queue, or return 0 if every queue is empty.
+static struct proc*
+rqsteal(int self)
+{
+  struct proc *p;
+  int i, n, victim;
+
+  for(;;){
+    victim = -1;
+    n = 0;
+    for(i = 0; i < NCPU; i++){
+      if(i != self && runqs[i].n > n){
+        n = runqs[i].n;
+        victim = i;
+      }
+    }
+    if(victim < 0)
+      return 0;
+    // the queue may have drained since we looked; try again.
+    if((p = rqpop(&runqs[victim])) != 0)
+      return p;
+  }
+}
+
+// Called by the scheduler on CPU self at most once every
+// BALANCE ticks, while self's queue is not empty. If a peer
+// has a process queued at a higher level than any of self's,
+// or at the same level but more than STEALSLACK behind in
+// pass, take the one furthest behind and return it.
+// Otherwise return 0. The peers' queues are peeked at
+// without their locks, and the victim re-checked under its.
+static struct proc*
+rqbalance(int self)
+{
+  struct runq *rq = &runqs[self];
+  struct proc *p, *h;
+  uint64 pass;
+  int i, l, pl, victim;
+
+  if(rq->n == 0 || ticks - rq->balanced < BALANCE)
+    return 0;
+  if((l = rqlevel(rq)) < 0 || (h = rq->level[l].head) == 0)
+    return 0;
+  pass = h->pass;
+  rq->balanced = ticks;
+
+  victim = -1;
+  for(i = 0; i < NCPU; i++){
+    if(i == self || runqs[i].n == 0)
+      continue;
+    if((pl = rqlevel(&runqs[i])) < 0 || (h = runqs[i].level[pl].head) == 0)
+      continue;
+    if(pl < l || (pl == l && h->pass + STEALSLACK < pass)){
+      l = pl;
+      pass = h->pass + STEALSLACK;
+      victim = i;
+    }
+  }
+  if(victim < 0)
+    return 0;
+
+  // the peer may have run or boosted its queue since.
+  p = 0;
+  rq = &runqs[victim];
+  acquire(&rq->lock);
+  if(rq->boost == mlfqboost && rqlevel(rq) == l &&
+     rq->level[l].head->pass + STEALSLACK <= pass)
+    p = rqtake(rq, l);
+  release(&rq->lock);
+  return p;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -124,21 +402,58 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->level = 0;
+  p->qticks = 0;
+  p->boost = mlfqboost;
+  p->tickets = NTICKETS;
+  p->stride = STRIDE1 / NTICKETS;
+  p->pass = 0;
+  p->ctime = ticks;
+  p->etime = 0;
+  p->rtime = 0;
+  p->wtime = 0;
+  p->stime = 0;
+  p->tstamp = ticks;
+  p->nvcsw = 0;
+  p->nivcsw = 0;
+
+  if(proc_mapstack(p) < 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
+  // Allocate a trapframe, which shares a page with others.
+  if((p->trapframe = (struct trapframe *)kmalloc(sizeof(struct trapframe))) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
-  // Allocate a trapframe page using slab allocator
-  if ((p->trapframe = (struct trapframe *)slab_alloc()) == 0) {
+  // Allocate the vdso page, which user code reads directly.
+  if((p->vdso = (struct vdso *)kalloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  memset(p->vdso, 0, PGSIZE);
+  p->vdso->timebase = TIMEBASE;
+  p->vdso->pid = p->pid;
 
   // An empty user page table.
+  p->asidgen = 0;
+  p->tlbcpu = -1;
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -156,12 +471,21 @@ static void
 freeproc(struct proc *p)
 {
   if(p->trapframe)
-    kfree((void*)p->trapframe);
+    kmfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->vdso)
+    kfree((void*)p->vdso);
+  p->vdso = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  // the window's page-table pages are the user page
+  // table's, freed above.
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -193,15 +517,26 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
-  // trampoline.S.
+  // map the page holding the trapframe just below the trampoline
+  // page, for trampoline.S, which finds the trapframe at
+  // TRAPFRAME plus its offset in the page.
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+              PGROUNDDOWN((uint64)(p->trapframe)), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
 
+  // map the vdso page just below the trapframe page,
+  // read-only, for user code.
+  if(mappages(pagetable, VDSO, PGSIZE,
+              (uint64)(p->vdso), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -212,6 +547,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -249,7 +585,9 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
+  p->cpu = cpuid();
   p->state = RUNNABLE;
+  rqpush(p, 0);
 
   release(&p->lock);
 }
@@ -264,9 +602,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // just reserve the memory; vmfault() allocates
+    // each page the first time it is touched.
+    if(sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -289,12 +629,17 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 1) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -307,9 +652,18 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idupexe(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // the child inherits its parent's share of the CPU.
+  np->tickets = p->tickets;
+  np->stride = p->stride;
+  np->pass = p->pass;
+
   pid = np->pid;
 
   release(&np->lock);
@@ -319,7 +673,9 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
+  np->cpu = cpuid();
   np->state = RUNNABLE;
+  rqpush(np, 0);
   release(&np->lock);
 
   return pid;
@@ -351,6 +707,10 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mmap() regions while
+  // their files are still open.
+  vmaunmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +722,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iputexe(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -376,6 +739,7 @@ exit(int status)
   acquire(&p->lock);
 
   p->xstate = status;
+  p->etime = ticks;
   p->state = ZOMBIE;
 
   release(&wait_lock);
@@ -389,9 +753,18 @@ exit(int status)
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
+{
+  return waitx(addr, 0);
+}
+
+// Like wait(), but if ruaddr is not 0 also copy out
+// the child's struct rusage.
+int
+waitx(uint64 addr, uint64 ruaddr)
 {
   struct proc *pp;
   int havekids, pid;
+  struct rusage ru;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -414,6 +787,20 @@ wait(uint64 addr)
             release(&wait_lock);
             return -1;
           }
+          if(ruaddr != 0){
+            ru.ctime = pp->ctime;
+            ru.etime = pp->etime;
+            ru.rtime = pp->rtime;
+            ru.wtime = pp->wtime;
+            ru.stime = pp->stime;
+            ru.nvcsw = pp->nvcsw;
+            ru.nivcsw = pp->nivcsw;
+            if(copyout(p->pagetable, ruaddr, (char *)&ru, sizeof(ru)) < 0){
+              release(&pp->lock);
+              release(&wait_lock);
+              return -1;
+            }
+          }
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -446,6 +833,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
 
   c->proc = 0;
   for(;;){
@@ -454,29 +842,46 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+    if((p = rqbalance(id)) == 0 && (p = rqpop(&runqs[id])) == 0)
+      p = rqsteal(id);
+    if(p == 0){
+      // nothing to run; zero a page for kalloc_zeroed(), or
+      // stop running on this core until an interrupt.
+      if(kzerofill())
+        continue;
       intr_on();
       asm volatile("wfi");
+      continue;
+    }
+
+    acquire(&p->lock);
+    if(p->boost != mlfqboost){
+      p->boost = mlfqboost;
+      p->level = 0;
+      p->qticks = 0;
+    }
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->wtime += ticks - p->tstamp;
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      if(c->kstackgen != kstackgen){
+        // another hart mapped a kernel stack, perhaps p's.
+        c->kstackgen = kstackgen;
+        sfence_vma();
+      }
+      uvmswitch(p);
+      swtch(&c->context, &p->context);
+      kvmswitch();
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -502,6 +907,11 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  // a timer interrupt during copyuser.S can yield with
+  // sstatus.SUM set; don't carry it into the scheduler or
+  // the next process. kerneltrap() restores it on return.
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -514,10 +924,73 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->tstamp = ticks;
+  p->nivcsw++;
+  rqpush(p, 0);
   sched();
   release(&p->lock);
 }
 
+// Called by the timer interrupt on each CPU. Charges the tick
+// to the running process, and decides whether it should give
+// up the CPU: either it has used its whole quantum at its
+// level, in which case it is also demoted, or a process of
+// higher priority is waiting on this CPU's run queue.
+// A process that sleeps before its quantum is up keeps
+// its level, and the ticks it has used so far.
+int
+mlfqtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  int l, preempt = 0;
+
+  if(p == 0)
+    return 0;
+
+  acquire(&p->lock);
+  p->pass += p->stride;
+  if(++p->qticks >= QUANTUM(p->level)){
+    if(p->level < NMLFQ-1)
+      p->level++;
+    p->qticks = 0;
+    preempt = 1;
+  } else {
+    rq = &runqs[p->cpu];
+    for(l = 0; l < p->level; l++)
+      if(rq->level[l].head)
+        preempt = 1;
+  }
+  release(&p->lock);
+
+  return preempt;
+}
+
+// Set the calling process's share of the CPU, relative to
+// the other processes at the same priority level.
+int
+settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if(n < 1 || n > STRIDE1)
+    return -1;
+
+  acquire(&p->lock);
+  p->tickets = n;
+  p->stride = STRIDE1 / n;
+  release(&p->lock);
+  return 0;
+}
+
+// Called every MLFQBOOST ticks, so that processes that have
+// sunk to the lowest level are not starved by interactive ones.
+void
+mlfqboostall(void)
+{
+  __sync_fetch_and_add(&mlfqboost, 1);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -542,34 +1015,83 @@ forkret(void)
   usertrapret();
 }
 
+// Return the wait queue that sleepers on chan are linked on.
+static struct waitq*
+chanwaitq(void *chan)
+{
+  // Fibonacci hashing; channels are mostly
+  // addresses of kernel objects.
+  uint64 h = (uint64)chan * 0x9E3779B97F4A7C15L;
+  return &waitqs[(h >> 32) % NWAITQ];
+}
+
+// Link p onto wq. Caller must hold wq->lock.
+static void
+wqlink(struct waitq *wq, struct proc *p)
+{
+  p->wq = wq;
+  p->wqprev = 0;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqprev = p;
+  wq->head = p;
+}
+
+// Unlink p from its wait queue. Caller must hold p->wq->lock.
+static void
+wqunlink(struct proc *p)
+{
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    p->wq->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  p->wqnext = p->wqprev = 0;
+  p->wq = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = chanwaitq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the wait queue),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);  //DOC: sleeplock0
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->tstamp = ticks;
+  p->nvcsw++;
+  wqlink(wq, p);
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() unlinks the processes it wakes, but a process
+  // woken by kill() is still on the wait queue.
+  acquire(&wq->lock);
+  if(p->wq)
+    wqunlink(p);
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -578,17 +1100,23 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = chanwaitq(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next) {
+    next = p->wqnext;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      wqunlink(p);
+      p->stime += ticks - p->tstamp;
+      p->tstamp = ticks;
+      p->state = RUNNABLE;
+      rqpush(p, 1);
     }
+    release(&p->lock);
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -605,7 +1133,10 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
+        p->stime += ticks - p->tstamp;
+        p->tstamp = ticks;
         p->state = RUNNABLE;
+        rqpush(p, 1);
       }
       release(&p->lock);
       return 0;
@@ -689,7 +1220,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s level %d tickets %d", p->pid, state, p->name,
+           p->level, p->tickets);
     printf("\n");
   }
 }
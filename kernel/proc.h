@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint kstackgen;             // kstackgen at this hart's last TLB flush
+  uint64 asidgen;             // ASID generation at this hart's last TLB flush
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +81,26 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A read-only ELF segment whose pages exec() left to be
+// read from the program file on first access.
+struct seg {
+  uint64 va;                   // Page-aligned start
+  uint64 end;                  // va + memsz
+  uint off;                    // File offset of va
+  uint filesz;                 // Bytes at va backed by the file
+  int perm;                    // PTE_X, from the segment's flags
+};
+
+// A region of memory created by mmap().
+struct vma {
+  uint64 start;                // Page-aligned; 0 if this slot is free
+  uint64 end;                  // Page-aligned
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+  struct file *f;              // Mapped file; 0 if anonymous
+  uint off;                    // File offset of start
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,6 +113,29 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint ctime;                  // Tick at which the process was created
+  uint etime;                  // Tick at which it exited
+  uint rtime;                  // Ticks spent RUNNING
+  uint wtime;                  // Ticks spent RUNNABLE
+  uint stime;                  // Ticks spent SLEEPING
+  uint tstamp;                 // Tick of the last RUNNABLE or SLEEPING transition
+  uint nvcsw;                  // Voluntary context switches
+  uint nivcsw;                 // Involuntary context switches
+  int cpu;                     // Run queue this process is placed on
+  int level;                   // MLFQ priority level, 0 is highest
+  int qticks;                  // Ticks used at this level
+  uint boost;                  // Value of mlfqboost when level was last reset
+  int tickets;                 // Stride scheduling share of the CPU
+  uint64 stride;               // STRIDE1 / tickets
+  uint64 pass;                 // Virtual time; lowest pass runs first
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next RUNNABLE process on the same run queue
+
+  // the wait queue's lock must be held when using these:
+  struct waitq *wq;            // Wait queue this process is linked on, if any
+  struct proc *wqnext;
+  struct proc *wqprev;
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -99,7 +144,16 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, with a window on pagetable
+  uint asid;                   // Tags pagetable's TLB entries; see uvmsatp()
+  uint64 asidgen;              // ASID generation asid belongs to
+  int tlbcpu;                  // Hart this process last ran on, or -1
   struct trapframe *trapframe; // data page for trampoline.S
+  struct vdso *vdso;           // user-readable data page, mapped at VDSO
+  struct inode *exe;           // Program file that seg[] pages are read from
+  struct seg seg[NSEG];        // Demand-paged segments
+  int nseg;
+  struct vma vma[NVMA];        // mmap() regions
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -0,0 +1,11 @@
+// Resource usage of an exited child process,
+// returned by waitx(). Times are in clock ticks.
+struct rusage {
+  uint ctime;   // Tick at which the process was created
+  uint etime;   // Tick at which it exited
+  uint rtime;   // Ticks spent RUNNING
+  uint wtime;   // Ticks spent RUNNABLE, waiting for a CPU
+  uint stime;   // Ticks spent SLEEPING
+  uint nvcsw;   // Voluntary context switches (sleeps)
+  uint nivcsw;  // Involuntary context switches (preemptions)
+};
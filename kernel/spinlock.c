@@ -8,12 +8,62 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every initialized lock, so that the statistics
+// device can report how contended each one is.
+// Short-lived locks, such as pipes', are left out with
+// initlocknostat(), so that creating and freeing them
+// doesn't serialize on lock_locks.
+#define NLOCK 500
+
+static struct spinlock *locks[NLOCK];
+static int nuntracked;  // locks initlock() found no slot for
+static struct spinlock lock_locks = { .name = "lock_locks" };
+
+// Initialize a lock without adding it to the
+// statistics, and without freelock() when it is freed.
 void
-initlock(struct spinlock *lk, char *name)
+initlocknostat(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  int i;
+
+  initlocknostat(lk, name);
+
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      break;
+    }
+  }
+  if(i == NLOCK)
+    nuntracked++;
+  release(&lock_locks);
+}
+
+// Forget a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  int i;
+
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -29,8 +79,9 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  __sync_fetch_and_add(&lk->n, 1);
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    __sync_fetch_and_add(&lk->nts, 1);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -108,3 +159,46 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Report the allocator's locks and the five most
+// contended locks for the statistics device.
+// Returns the number of characters written to buf.
+int
+statslock(char *buf, int sz)
+{
+  struct spinlock *lk, *top[5];
+  uint64 tot;
+  int i, j, k, n;
+
+  n = snprintf(buf, sz, "--- lock kmem stats\n");
+  tot = 0;
+  memset(top, 0, sizeof(top));
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if((lk = locks[i]) == 0)
+      continue;
+    if(strncmp(lk->name, "kmem", 4) == 0)
+      n += snprintf(buf+n, sz-n, "lock: %s: #test-and-set %u #acquire() %u\n",
+                    lk->name, lk->nts, lk->n);
+    tot += lk->nts;
+    // keep top[] sorted, most contended first.
+    for(j = 0; j < 5; j++){
+      if(top[j] == 0 || lk->nts > top[j]->nts){
+        for(k = 4; k > j; k--)
+          top[k] = top[k-1];
+        top[j] = lk;
+        break;
+      }
+    }
+  }
+  n += snprintf(buf+n, sz-n, "--- top 5 contended locks:\n");
+  for(j = 0; j < 5 && top[j]; j++)
+    n += snprintf(buf+n, sz-n, "lock: %s: #test-and-set %u #acquire() %u\n",
+                  top[j]->name, top[j]->nts, top[j]->n);
+  j = nuntracked;
+  release(&lock_locks);
+  n += snprintf(buf+n, sz-n, "tot= %lu\n", tot);
+  if(j > 0)
+    n += snprintf(buf+n, sz-n, "%d locks not tracked: lock table full\n", j);
+  return n;
+}
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For the statistics device:
+  uint n;            // Number of acquire()s.
+  uint nts;          // Number of failed test-and-sets while spinning.
 };
 
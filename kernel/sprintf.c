@@ -0,0 +1,103 @@
+//
+// formatted output to a buffer, for the statistics device.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int
+sputc(char *s, int i, int sz, char c)
+{
+  if(i < sz - 1)
+    s[i] = c;
+  return i + 1;
+}
+
+static int
+sprintint(char *s, int i, int sz, long long xx, int base, int sign)
+{
+  char buf[20];
+  int n;
+  unsigned long long x;
+
+  if(sign && (sign = (xx < 0)))
+    x = -xx;
+  else
+    x = xx;
+
+  n = 0;
+  do {
+    buf[n++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[n++] = '-';
+
+  while(--n >= 0)
+    i = sputc(s, i, sz, buf[n]);
+  return i;
+}
+
+// Print to buf, which holds sz bytes, and always
+// null-terminate it. Understands %d, %u, %x, their
+// %l forms, %s and %%.
+// Returns the number of characters written, not
+// counting the null.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, n, c0, c1;
+  char *s;
+
+  if(sz <= 0)
+    return 0;
+
+  n = 0;
+  va_start(ap, fmt);
+  for(i = 0; (c0 = fmt[i] & 0xff) != 0; i++){
+    if(c0 != '%'){
+      n = sputc(buf, n, sz, c0);
+      continue;
+    }
+    c0 = fmt[++i] & 0xff;
+    c1 = c0 ? fmt[i+1] & 0xff : 0;
+    if(c0 == 'd'){
+      n = sprintint(buf, n, sz, va_arg(ap, int), 10, 1);
+    } else if(c0 == 'l' && c1 == 'd'){
+      n = sprintint(buf, n, sz, va_arg(ap, uint64), 10, 1);
+      i += 1;
+    } else if(c0 == 'u'){
+      n = sprintint(buf, n, sz, va_arg(ap, uint), 10, 0);
+    } else if(c0 == 'l' && c1 == 'u'){
+      n = sprintint(buf, n, sz, va_arg(ap, uint64), 10, 0);
+      i += 1;
+    } else if(c0 == 'x'){
+      n = sprintint(buf, n, sz, va_arg(ap, uint), 16, 0);
+    } else if(c0 == 'l' && c1 == 'x'){
+      n = sprintint(buf, n, sz, va_arg(ap, uint64), 16, 0);
+      i += 1;
+    } else if(c0 == 's'){
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        n = sputc(buf, n, sz, *s);
+    } else if(c0 == '%'){
+      n = sputc(buf, n, sz, '%');
+    } else if(c0 == 0){
+      break;
+    } else {
+      n = sputc(buf, n, sz, '%');
+      n = sputc(buf, n, sz, c0);
+    }
+  }
+  va_end(ap);
+
+  buf[n < sz ? n : sz - 1] = 0;
+  return n < sz ? n : sz - 1;
+}
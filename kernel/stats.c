@@ -0,0 +1,60 @@
+//
+// The statistics device: reading it returns a report of
+// lock contention, allocator and buffer cache state, generated when
+// the first read starts at the beginning.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;            // Length of the report in buf
+  int off;           // Bytes of it already read
+} stats;
+
+// user_dst indicates whether dst is a user
+// or kernel address.
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquire(&stats.lock);
+  if(stats.sz == 0){
+    stats.sz = statslock(stats.buf, BUFSZ);
+    stats.sz += kallocstats(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += kmallocstats(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += bcachestats(stats.buf + stats.sz, BUFSZ - stats.sz);
+  }
+  m = stats.sz - stats.off;
+  if(m > n)
+    m = n;
+  if(m > 0 && either_copyout(user_dst, dst, stats.buf + stats.off, m) < 0)
+    m = -1;
+  else if(m > 0)
+    stats.off += m;
+  else
+    // end of the report; the next read starts a new one.
+    stats.sz = stats.off = 0;
+  release(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initlock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = 0;
+}
@@ -20,3 +20,8 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_settickets 22
+#define SYS_waitx  23
+#define SYS_clock_gettime 24
+#define SYS_mmap   25
+#define SYS_munmap 26
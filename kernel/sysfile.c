@@ -76,6 +76,8 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  if(n > 0 && vmprefault(myproc(), p, n) < 0)
+    return -1;
   return fileread(f, p, n);
 }
 
@@ -90,6 +92,8 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  if(n > 0 && vmprefault(myproc(), p, n) < 0)
+    return -1;
 
   return filewrite(f, p, n);
 }
@@ -348,6 +352,14 @@ sys_open(void)
     return -1;
   }
 
+  // A running program can't be truncated; fail before
+  // allocating anything.
+  if((omode & O_TRUNC) && ip->type == T_FILE && ip->nexec > 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   // Allocate a new file structure
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
@@ -375,7 +387,8 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
-  // If O_TRUNC is set, truncate the file
+  // If O_TRUNC is set, truncate the file. This can't fail:
+  // exec() needs the inode lock to make it a running program.
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -521,3 +534,45 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off): addr is only a
+// hint and is ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if(len == 0 || off % PGSIZE != 0 || off + len < off)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+
+  f = 0;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE)
+      return -1;
+    if(off >= MAXFILE*BSIZE)
+      return -1;
+    if((prot & PROT_READ) && !f->readable)
+      return -1;
+    if((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)
+      return -1;
+  }
+  return vmamap(myproc(), len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return vmaunmap(myproc(), addr, len);
+}
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "time.h"
+#include "rusage.h"
 
 uint64
 sys_exit(void)
@@ -32,9 +34,25 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
+  // wait() copies out while holding wait_lock.
+  if(p && vmprefault(myproc(), p, sizeof(int)) < 0)
+    return -1;
   return wait(p);
 }
 
+uint64
+sys_waitx(void)
+{
+  uint64 p, ru;
+  argaddr(0, &p);
+  argaddr(1, &ru);
+  if(p && vmprefault(myproc(), p, sizeof(int)) < 0)
+    return -1;
+  if(ru && vmprefault(myproc(), ru, sizeof(struct rusage)) < 0)
+    return -1;
+  return waitx(p, ru);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -91,3 +109,34 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  argint(0, &n);
+  return settickets(n);
+}
+
+// read a clock at the resolution of the time CSR,
+// rather than in clock ticks like uptime().
+uint64
+sys_clock_gettime(void)
+{
+  int clockid;
+  uint64 addr, t;
+  struct timespec ts;
+
+  argint(0, &clockid);
+  argaddr(1, &addr);
+  if(clockid != CLOCK_MONOTONIC)
+    return -1;
+
+  t = r_time();
+  ts.tv_sec = t / TIMEBASE;
+  ts.tv_nsec = (t % TIMEBASE) * (1000000000L / TIMEBASE);
+  if(copyout(myproc()->pagetable, addr, (char *)&ts, sizeof(ts)) < 0)
+    return -1;
+  return 0;
+}
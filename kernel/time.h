@@ -0,0 +1,7 @@
+// Clocks for clock_gettime().
+#define CLOCK_MONOTONIC 1   // time since boot, from the time CSR
+
+struct timespec {
+  uint64 tv_sec;   // Seconds
+  uint64 tv_nsec;  // Nanoseconds, less than 1000000000
+};
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -27,6 +28,11 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user code read the time CSR, which
+  // together with the vdso page gives it a
+  // clock that needs no system call.
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -67,6 +73,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p, r_stval(), r_scause() == 15) == 0){
+    // page fault on demand-paged, lazily allocated or
+    // copy-on-write memory, which is now mapped.
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -76,8 +86,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt
+  // and the process has used up its time slice.
+  if(which_dev == 2 && mlfqtick())
     yield();
 
   usertrapret();
@@ -113,20 +124,26 @@ usertrapret(void)
   // set S Previous Privilege mode to User.
   unsigned long x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
+  x &= ~SSTATUS_SUM; // only copyuser.S runs with SUM set
   x |= SSTATUS_SPIE; // enable interrupts in user mode
   w_sstatus(x);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // the process may have been asleep for a while.
+  p->vdso->ticks = ticks;
+
+  // tell trampoline.S the user page table to switch to, and
+  // where the trapframe is in it.
+  uint64 satp = uvmsatp(p);
+  uint64 trapframe = TRAPFRAME + (uint64)p->trapframe % PGSIZE;
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, trapframe);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -144,14 +161,18 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) && kvmfault(r_stval(), scause == 15, &sepc) == 0){
+    // a page fault in a copy to or from user memory,
+    // which resumes at sepc.
+  } else if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
+  // give up the CPU if this is a timer interrupt
+  // and the process has used up its time slice.
+  if(which_dev == 2 && myproc() != 0 && mlfqtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -163,13 +184,26 @@ kerneltrap()
 void
 clockintr()
 {
+  struct proc *p = myproc();
+
+  // charge the tick to whichever process this CPU is running.
+  // only this CPU updates p->rtime while p is RUNNING.
+  if(p != 0)
+    p->rtime++;
+
   if(cpuid() == 0){
     acquire(&tickslock);
     ticks++;
+    if(ticks % MLFQBOOST == 0)
+      mlfqboostall();
     wakeup(&ticks);
     release(&tickslock);
   }
 
+  // keep the running process's vdso page current.
+  if(p != 0)
+    p->vdso->ticks = ticks;
+
   // ask for the next timer interrupt. this also clears
   // the interrupt request. 1000000 is about a tenth
   // of a second.
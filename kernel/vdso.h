@@ -0,0 +1,11 @@
+// The vdso page: read-only data that the kernel maps,
+// user-accessible, at VDSO in every process's address
+// space, so that user code can read it without a
+// system call. The kernel refreshes ticks on every
+// return to user space and on every clock interrupt
+// while the process is running.
+struct vdso {
+  uint64 ticks;     // Clock tick count, as returned by uptime()
+  uint64 timebase;  // Clock base: time CSR frequency, in Hz
+  int pid;          // Process ID, as returned by getpid()
+};
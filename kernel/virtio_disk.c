@@ -19,6 +19,9 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// most blocks merge() puts in one request.
+#define MAXSEG 32
+
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
@@ -42,12 +45,21 @@ static struct disk {
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
+  // first descriptors of requests not yet in the avail
+  // ring, which kick() adds. until then a request for the
+  // blocks just after another's can be merged into it.
+  uint16 unkicked[NUM];
+  int nunkicked;
+
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // first of the request's bufs, through qnext
     char status;
+    char write;
+    int nblk;        // number of blocks
+    int last;        // descriptor of the last block's data
   } info[NUM];
 
   // disk command headers.
@@ -212,16 +224,95 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// put the requests started since the last kick in the
+// avail ring and tell the device about them. one
+// notification covers the whole batch.
+// caller must hold vdisk_lock.
+static void
+kick(void)
+{
+  if(disk.nunkicked == 0)
+    return;
+
+  // tell the device the first index in each chain of descriptors.
+  for(int i = 0; i < disk.nunkicked; i++)
+    disk.avail->ring[(disk.avail->idx + i) % NUM] = disk.unkicked[i];
+
+  __sync_synchronize();
+
+  // tell the device more avail ring entries are available.
+  disk.avail->idx += disk.nunkicked; // not % NUM ...
+
+  __sync_synchronize();
+
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  disk.nunkicked = 0;
+}
+
+// if an unkicked request in the same direction ends just
+// before b's block, add a descriptor for b's data to it,
+// so that the device transfers both with one request.
+// returns 0 on success, -1 if b needs a request of its own.
+// caller must hold vdisk_lock.
+static int
+merge(struct buf *b, int write)
+{
+  int i, id, d;
+  struct buf *lb;
+
+  for(i = 0; i < disk.nunkicked; i++){
+    id = disk.unkicked[i];
+    if(disk.info[id].write != write || disk.info[id].nblk >= MAXSEG)
+      continue;
+    if(disk.ops[id].sector + disk.info[id].nblk * (BSIZE / 512) !=
+       b->blockno * (BSIZE / 512))
+      continue;
+    if((d = alloc_desc()) < 0)
+      return -1;
+
+    // hdr -> ... -> last -> d -> status.
+    disk.desc[d].addr = (uint64) b->data;
+    disk.desc[d].len = BSIZE;
+    disk.desc[d].flags = disk.desc[disk.info[id].last].flags;
+    disk.desc[d].next = disk.desc[disk.info[id].last].next;
+    disk.desc[disk.info[id].last].next = d;
+    disk.info[id].last = d;
+    disk.info[id].nblk++;
+
+    for(lb = disk.info[id].b; lb->qnext; lb = lb->qnext)
+      ;
+    b->qnext = 0;
+    b->disk = 1;
+    lb->qnext = b;
+    return 0;
+  }
+  return -1;
+}
+
+// start reading or writing b, without waiting for the
+// disk to finish. b must be locked. the device isn't
+// told of the request until virtio_disk_kick() or
+// virtio_disk_wait(), so that a caller can start a batch,
+// and contiguous blocks in a batch go to the device as
+// one request. virtio_disk_intr() frees the descriptors,
+// and, if b->async is set, hands b back to bio.c with
+// bdone().
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_start(struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
   acquire(&disk.vdisk_lock);
 
+  if(merge(b, write) == 0){
+    release(&disk.vdisk_lock);
+    return;
+  }
+
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. merge() may add
+  // more data descriptors later.
 
   // allocate the three descriptors.
   int idx[3];
@@ -229,6 +320,9 @@ virtio_disk_rw(struct buf *b, int write)
     if(alloc3_desc(idx) == 0) {
       break;
     }
+    // the descriptors may all be held by requests that
+    // are waiting for a kick.
+    kick();
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
@@ -266,31 +360,46 @@ virtio_disk_rw(struct buf *b, int write)
 
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
+  b->qnext = 0;
   disk.info[idx[0]].b = b;
+  disk.info[idx[0]].write = write;
+  disk.info[idx[0]].nblk = 1;
+  disk.info[idx[0]].last = idx[1];
 
-  // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
-
-  __sync_synchronize();
-
-  // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  disk.unkicked[disk.nunkicked++] = idx[0];
 
-  __sync_synchronize();
+  release(&disk.vdisk_lock);
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// tell the device about the requests started so far.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
+  release(&disk.vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// wait for the disk to finish with b, first telling it
+// about any requests not yet kicked.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +426,17 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    while(b){
+      struct buf *nb = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->async)
+        bdone(b);
+      else
+        wakeup(b);
+      b = nb;
+    }
 
     disk.used_idx += 1;
   }
@@ -3,9 +3,14 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
+#define MEGAORDER 9  // a megapage is 2^9 pages
+#define NFLUSH 16    // flush more pages than this all at once
+
 /*
  * the kernel's page table.
  */
@@ -43,7 +48,8 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
+  // page-table pages for the kernel stacks, which are
+  // mapped as processes are created.
   proc_mapstacks(kpgtbl);
   
   return kpgtbl;
@@ -64,12 +70,220 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Each process has its own kernel page table, which maps
+// the kernel like kernel_pagetable does and, in its upper
+// half, has a window onto the process's user memory: the
+// level-1 page-table pages of the user page table appear
+// at UWINDOW, so that copyin() and copyout() can reach
+// user addresses through the MMU. The window's level-2
+// PTEs are copied from the user page table when the
+// kernel first faults on them; see kvmfault().
+
+// Make a kernel page table for a new process, with an
+// empty window. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpgtbl;
+
+  if((kpgtbl = (pagetable_t)kalloc_zeroed()) == 0)
+    return 0;
+  // the kernel's level-2 PTEs, which never change.
+  memmove(kpgtbl, kernel_pagetable, PX(2, UWINDOW) * sizeof(pte_t));
+  return kpgtbl;
+}
+
+// Empty p's window, after exec() replaces its user
+// page table.
+void
+kvmwinreset(struct proc *p)
+{
+  memset(&p->kpagetable[PX(2, UWINDOW)], 0, (512 - PX(2, UWINDOW)) * sizeof(pte_t));
+  uvmflush(p->pagetable, -1);
+}
+
+// Address-space identifiers, so that the TLB can hold the
+// entries of several page tables at once and switching
+// between them needs no flush. Each process has a pair:
+// an odd one for its user page table and the next for its
+// kernel page table; kernel_pagetable's is 0. ASIDs are
+// handed out in order; when they run out, a new generation
+// starts: each process gets new ASIDs when it next runs,
+// and each hart flushes its whole TLB first.
+// A hart may also hold stale entries for a process that
+// has since run elsewhere, so a process that moves to
+// another hart has its ASIDs flushed there.
+struct {
+  struct spinlock lock;
+  uint64 gen;        // Current generation
+  uint next;         // Next ASID to hand out in gen
+  uint max;          // Largest ASID the hardware has, 0 if too few
+} asids;
+
+// Find out how many ASIDs the hardware has, by writing
+// all ones to satp's ASID field and reading it back.
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+  w_satp(MAKE_SATP(kernel_pagetable, SATP_ASID_MASK));
+  asids.max = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+  sfence_vma();
+  if(asids.max < 2)
+    asids.max = 0;
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// The ASID of p's kernel page table.
+static uint
+kasid(struct proc *p)
+{
+  return asids.max ? p->asid + 1 : 0;
+}
+
+// Switch this hart to p's kernel page table, for the
+// scheduler to run p, first giving p ASIDs of the current
+// generation and flushing whatever stale entries this hart
+// may hold. Called with p->lock held.
+void
+uvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 gen;
+
+  if(asids.max == 0){
+    // every page table's entries are tagged 0.
+    w_satp(MAKE_SATP(p->kpagetable, 0));
+    sfence_vma();
+    return;
+  }
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if(p->asidgen != gen){
+    acquire(&asids.lock);
+    if(asids.next + 1 > asids.max){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next;
+    asids.next += 2;
+    p->asidgen = gen = asids.gen;
+    release(&asids.lock);
+  }
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(p->tlbcpu != id){
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(kasid(p));
+  }
+  p->tlbcpu = id;
+  w_satp(MAKE_SATP(p->kpagetable, kasid(p)));
+}
+
+// Switch this hart back to kernel_pagetable, for the
+// scheduler, after running a process.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+}
+
+// Return the satp value for p's user page table, for
+// usertrapret(). Called with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  // without ASIDs, userret flushes after switching.
+  return MAKE_SATP(p->pagetable, p->asid);
+}
+
+// Flush this hart's TLB entries for va in the current
+// process's page table and its window, after changing
+// va's PTE; or, if va is -1, all of their entries.
+// Other harts are flushed when the process next runs
+// there (see uvmswitch()).
+void
+uvmflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  if(va == -1){
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(kasid(p));
+  } else {
+    sfence_vma_page(va, p->asid);
+    sfence_vma_page(UWINDOW + va, kasid(p));
+  }
+}
+
+// Entries of __ex_table: an instruction in copyuser.S
+// that touches user memory, and where to resume if it
+// faults and the fault can't be resolved.
+struct exentry {
+  uint64 insn;
+  uint64 fixup;
+};
+
+extern struct exentry ex_table_start[], ex_table_end[];  // kernel.ld
+
+// Handle a page fault at va by kernel code at *epc. If
+// it is a copy through the current process's window, map
+// the window's level-1 page-table page or fault in the
+// user page, and retry; or resume at the instruction's
+// fixup, which fails the copy.
+// Returns -1 if the fault is not a copy's.
+int
+kvmfault(uint64 va, int write, uint64 *epc)
+{
+  struct proc *p = myproc();
+  struct exentry *e;
+  pte_t *kpte, pte;
+  uint64 uva;
+
+  for(e = ex_table_start; e < ex_table_end; e++)
+    if(e->insn == *epc)
+      break;
+  if(e == ex_table_end || p == 0 || va < UWINDOW)
+    return -1;
+
+  uva = va - UWINDOW;
+  kpte = &p->kpagetable[PX(2, va)];
+  pte = p->pagetable[PX(2, uva)];
+  if((*kpte & PTE_V) == 0 && (pte & PTE_V)){
+    *kpte = pte;
+    sfence_vma_page(va, kasid(p));
+    return 0;
+  }
+  if(uva < TRAPFRAME && vmfault(p, uva, write) == 0)
+    return 0;
+  *epc = e->fixup;
+  return 0;
+}
+
+// Can the kernel reach [va, va+len) of pagetable through
+// the current process's window? Not the trapframe and
+// trampoline pages, which only the kernel may touch.
+static int
+inwindow(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && p->pagetable == pagetable &&
+         va < TRAPFRAME && len <= TRAPFRAME - va;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,6 +296,26 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 PTE may instead be a leaf that maps a 2-megabyte
+// megapage. walk() splits a megapage covering va into 4096-
+// byte pages, and returns 0 if it can't allocate the new
+// page-table page; see walkleaf() to look up a va without
+// splitting.
+// Split the megapage that level-1 PTE *pte maps: make t,
+// a page-table page, map its 4096-byte pages with the same
+// permissions, and point *pte at t.
+static void
+demote(pte_t *pte, pagetable_t t)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  for(int i = 0; i < 512; i++)
+    t[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(t) | PTE_V;
+}
+
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -91,37 +325,78 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        pagetable_t t;
+        if((t = (pagetable_t)kalloc()) == 0)
+          return 0;
+        demote(pte, t);
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
-// Can only be used to look up user pages.
-uint64
-walkaddr(pagetable_t pagetable, uint64 va)
+// Return the address of the leaf PTE that maps va, of
+// either a page or a megapage, and set *size to the size
+// of what it maps. Returns 0 if va is not mapped.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, uint64 *size)
 {
   pte_t *pte;
-  uint64 pa;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  for(int level = 2; level >= 0; level--) {
+    pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte)){
+      *size = 1L << PXSHIFT(level);
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// Return the address of the level-1 PTE for va, creating
+// the level-1 page-table page if alloc!=0.
+static pte_t *
+walk1(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if(*pte & PTE_V){
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
+// Can only be used to look up user pages.
+uint64
+walkaddr(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa, size;
+
+  pte = walkleaf(pagetable, va, &size);
   if(pte == 0)
     return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (size - 1));
   return pa;
 }
 
@@ -137,7 +412,9 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
-// va and size MUST be page-aligned.
+// va and size MUST be page-aligned. Maps megapages where
+// va and pa are both megapage-aligned, at least a megapage
+// remains, and no page-table page is in the way.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
@@ -158,6 +435,18 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for(;;){
+    if(a % MEGAPAGE == 0 && pa % MEGAPAGE == 0 && last - a >= MEGAPAGE - PGSIZE){
+      if((pte = walk1(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte == 0){
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(last - a == MEGAPAGE - PGSIZE)
+          break;
+        a += MEGAPAGE;
+        pa += MEGAPAGE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -172,30 +461,56 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never faulted in are
+// skipped. Optionally free the physical memory.
+// A megapage that is only partly unmapped is split first.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, sz;
+  pagetable_t t;
   pte_t *pte;
+  int n;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
+  n = 0;
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += sz){
+    sz = PGSIZE;
+    if((pte = walkleaf(pagetable, a, &sz)) == 0)
+      continue;
+    if(sz == MEGAPAGE && a % MEGAPAGE == 0 && a + MEGAPAGE <= end){
+      // megapages are never shared, so this frees them.
+      if(do_free)
+        kfree_pages((void*)PTE2PA(*pte), MEGAORDER);
+      *pte = 0;
+      n += NFLUSH;
+      continue;
+    }
+    if(sz == MEGAPAGE){
+      // use the page at a, which is going away, as the
+      // page-table page, so that this needs no memory.
+      if(!do_free)
+        panic("uvmunmap: megapage");
+      t = (pagetable_t)(PTE2PA(*pte) + (a & (MEGAPAGE - 1)));
+      demote(pte, t);
+      t[PX(0, a)] = 0;
+      uvmflush(pagetable, a);
+      sz = PGSIZE;
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
     *pte = 0;
+    if(++n <= NFLUSH)
+      uvmflush(pagetable, a);
   }
+  if(n > NFLUSH)
+    uvmflush(pagetable, -1);
 }
 
 // create an empty user page table.
@@ -204,10 +519,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,31 +535,55 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
+// Map a zeroed megapage at megapage-aligned va, if a free
+// megapage is at hand and nothing is mapped in
+// [va, va+MEGAPAGE). Returns 0 on success, -1 if not.
+static int
+uvmmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walk1(pagetable, va, 0)) != 0 && *pte != 0)
+    return -1;
+  if((mem = kalloc_pages_try(MEGAORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGAPAGE);
+  if(mappages(pagetable, va, MEGAPAGE, (uint64)mem, perm) != 0){
+    kfree_pages(mem, MEGAORDER);
+    return -1;
+  }
+  return 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, sz;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+  for(a = oldsz; a < newsz; a += sz){
+    sz = MEGAPAGE;
+    if(a % MEGAPAGE == 0 && a + MEGAPAGE <= newsz &&
+       uvmmega(pagetable, a, PTE_R|PTE_U|xperm) == 0)
+      continue;
+    sz = PGSIZE;
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -303,43 +641,290 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, make its memory
+// in [start, end) available in a child's page table:
+// the child maps the same physical pages. If cow, any
+// writable page is made read-only and marked PTE_COW
+// in both, so that the first write to it by either
+// process gets a private copy (see uvmcow()); otherwise
+// the pages stay writable and shared.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, sz;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = start; i < end; i += PGSIZE){
+    // pages the parent never touched stay lazy in the child.
+    if((pte = walkleaf(old, i, &sz)) == 0)
+      continue;
+    // split the parent's megapages, so that the pages
+    // can be shared and copied one at a time.
+    if(sz == MEGAPAGE && (pte = walk(old, i, 0)) == 0)
+      goto err;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kincref((void*)pa);
   }
+  // the parent's writable pages are now read-only.
+  uvmflush(old, -1);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmflush(old, -1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
+// Resolve a write to the copy-on-write page at va by
+// giving pagetable a private, writable copy of it, or
+// just making it writable if no one else shares it.
+// Returns 0 on success, -1 if va is not a
+// copy-on-write user page or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+  if(krefcount((void*)pa) == 1){
+    // the other sharers have all gone.
+    *pte = PA2PTE(pa) | flags;
+    uvmflush(pagetable, va);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  uvmflush(pagetable, va);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Return the demand-paged segment of p containing va, or 0.
+static struct seg*
+findseg(struct proc *p, uint64 va)
+{
+  struct seg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(va >= s->va && va < s->end)
+      return s;
+  return 0;
+}
+
+// Can the megapage containing va be part of p's heap?
+// Only if it lies entirely below p->sz, clear of the
+// segments exec() loaded (regions are all above p->sz).
+static int
+megaheap(struct proc *p, uint64 va)
+{
+  struct seg *s;
+  uint64 a = va & ~(MEGAPAGE - 1);
+
+  if(a + MEGAPAGE > p->sz)
+    return 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(s->va < a + MEGAPAGE && s->end > a)
+      return 0;
+  return 1;
+}
+
+// Is this hart holding a spinlock? Reading in a page of
+// a file needs ilock() and bread(), which may sleep.
+static int
+holdingspin(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n > 1;
+}
+
+// Handle a page fault at va in process p's address space:
+// read in a page of a segment that exec() left in the
+// program file or of an mmap() region, allocate a zeroed
+// page for memory that sbrk() has reserved but that has
+// not been touched yet, resolve a write to a
+// copy-on-write page, or set a PTE's A or D bit.
+// Returns 0 if the faulting access can be retried, or
+// -1 if it is invalid, memory is exhausted, or the page
+// would have to be read from a file while holding a
+// spinlock (see vmprefault()).
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  struct seg *s;
+  struct vma *v;
+  char *mem;
+  uint64 sz;
+  uint n;
+  int perm;
+
+  v = vmalookup(p, va);
+  if(v == 0 && va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walkleaf(p->pagetable, va, &sz);
+  if(pte){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(p->pagetable, va);
+    // hardware that leaves A and D to software (Svade)
+    // faults on the first access to a page, or the first
+    // store to a clean one, such as a shared file page
+    // that was mapped on a read.
+    if((*pte & PTE_U) && (*pte & (write ? PTE_W : PTE_R)) &&
+       ((*pte & PTE_A) == 0 || (write && (*pte & PTE_D) == 0))){
+      *pte |= PTE_A | (write ? PTE_D : 0);
+      uvmflush(p->pagetable, va);
+      return 0;
+    }
+    // e.g. the stack guard page.
+    return -1;
+  }
+  if(v){
+    if(v->f && holdingspin())
+      return -1;
+    return vmafault(p, v, va, write);
+  }
+
+  perm = PTE_W;
+  if((s = findseg(p, va)) != 0){
+    if(write)
+      return -1;
+    perm = s->perm;
+  }
+
+  if(s && va - s->va < s->filesz){
+    // share the page with other processes running
+    // the same program.
+    if(holdingspin())
+      return -1;
+    n = s->filesz - (va - s->va);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if((mem = pcread(p->exe, s->off + (va - s->va), n)) == 0)
+      return -1;
+  } else {
+    // heap memory that sbrk() reserved: take a whole
+    // megapage if one fits.
+    if(s == 0 && megaheap(p, va) &&
+       uvmmega(p->pagetable, va & ~(MEGAPAGE - 1), PTE_R|PTE_W|PTE_U) == 0){
+      uvmflush(p->pagetable, va);
+      return 0;
+    }
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  // the TLB may hold the invalid PTE.
+  uvmflush(p->pagetable, va);
+  return 0;
+}
+
+// Fault in the unmapped pages of [va, va+len) that lie
+// in [start, end). Returns -1 if one can't be.
+static int
+prefaultrange(struct proc *p, uint64 va, uint64 len, uint64 start, uint64 end)
+{
+  uint64 a, sz;
+
+  if(va >= end || va + len <= start || va + len < va)
+    return 0;
+  a = PGROUNDDOWN(va > start ? va : start);
+  if(va + len < end)
+    end = va + len;
+  for(; a < end; a += PGSIZE){
+    if(walkleaf(p->pagetable, a, &sz) == 0 && vmfault(p, a, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Read in any not-yet-loaded pages of p's program file or
+// of mmap()ed files that lie in [va, va+len), so that
+// copyin() or copyout() of them will not sleep in ilock().
+// read() and write() call this before they take an inode
+// lock or a pipe's or the console's spinlock, and wait()
+// before it takes wait_lock; they fail if it does, since
+// vmfault() would refuse the pages under the spinlock.
+// Returns 0, or -1 if a page can't be read in, because
+// memory is exhausted or the access isn't allowed.
+int
+vmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  struct seg *s;
+  struct vma *v;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(prefaultrange(p, va, len, s->va, s->end) < 0)
+      return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && v->f && prefaultrange(p, va, len, v->start, v->end) < 0)
+      return -1;
+  return 0;
+}
+
+// Return the physical address of the user page at
+// page-aligned va0, for copyin() and copyout(). If
+// pagetable is the current process's, first fault in
+// a lazily allocated page, and, if write, give it a
+// private copy of a copy-on-write page.
+// Returns 0 if va0 is not accessible.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 sz;
+
+  pte = walkleaf(pagetable, va0, &sz);
+  if(pte == 0 || (write && (*pte & PTE_W) == 0)){
+    if(va0 >= MAXVA || p == 0 || p->pagetable != pagetable ||
+       vmfault(p, va0, write) < 0)
+      return 0;
+    if((pte = walkleaf(pagetable, va0, &sz)) == 0)
+      return 0;
+  }
+  if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+    return 0;
+  // the kernel writes through its own mapping, so mark
+  // the page dirty for write-back of shared mappings.
+  if(write)
+    *pte |= PTE_D;
+  return PTE2PA(*pte) + (va0 & (sz - 1));
+}
+
+// mark a PTE invalid for user access, and for the
+// kernel's copies through the window too: execute-only,
+// without PTE_U, it stays a valid leaf that neither can
+// read or write.
 // used by exec for the user stack guard page.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
@@ -349,7 +934,8 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+  uvmflush(pagetable, va);
 }
 
 // Copy from kernel to user.
@@ -359,17 +945,15 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
+
+  if(inwindow(pagetable, dstva, len))
+    return copy_user((char*)(UWINDOW + dstva), src, len);
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-      return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
+    pa0 = uvmaddr(pagetable, va0, 1);
+    if(pa0 == 0)
       return -1;
-    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -390,9 +974,12 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(inwindow(pagetable, srcva, len))
+    return copy_user(dst, (char*)(UWINDOW + srcva), len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -417,9 +1004,12 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(inwindow(pagetable, srcva, max))
+    return copy_user_str(dst, (char*)(UWINDOW + srcva), max);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -71,37 +71,38 @@ void log_metrics(int alloc_time, int access_time, int free_time) {
 }
 
 int main() {
+    // times are in microseconds
     int alloc_time, access_time, free_time;
     alloc_time = access_time = free_time = 0;
-    int aux = 0;
+    uint64 aux = 0;
 
     for (int j = 0; j < N_DIGRAPHS; j++) {
         int vertices = MIN_VERTICES + rand() % (MAX_VERTICES - MIN_VERTICES + 1);
         int edges = MIN_EDGES + rand() % (MAX_EDGES - MIN_EDGES + 1);
 
         // Measure allocation time
-        aux = uptime();
+        aux = usecs();
         int **graph = malloc(vertices * sizeof(int *));
         for (int i = 0; i < vertices; i++) {
             graph[i] = malloc(vertices * sizeof(int));
         }
-        alloc_time += uptime() - aux;
+        alloc_time += usecs() - aux;
 
         // Start graph
         initialize_graph(graph, vertices, edges);
 
         // Measure access time for Dijkstra
-        aux = uptime();
+        aux = usecs();
         dijkstra(graph, vertices, 0);
-        access_time += uptime() - aux;
+        access_time += usecs() - aux;
 
         // Measure free time
-        aux = uptime();
+        aux = usecs();
         for (int i = 0; i < vertices; i++) {
             free(graph[i]);
         }
         free(graph);
-        free_time += uptime() - aux;
+        free_time += usecs() - aux;
 
     }
 
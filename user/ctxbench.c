@@ -0,0 +1,72 @@
+// ctxbench: measure the cost of a context switch between
+// two processes, including the TLB misses that follow it.
+// The processes take turns through a pair of pipes, and
+// each touches a working set of pages on every turn.
+//
+// usage: ctxbench [rounds [pages]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 10000, npages = 16;
+  int p1[2], p2[2], pid, i, j;
+  uint64 t0, t1;
+  char *mem, c;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    npages = atoi(argv[2]);
+  if(rounds <= 0 || npages < 0){
+    fprintf(2, "usage: ctxbench [rounds [pages]]\n");
+    exit(1);
+  }
+
+  if((mem = sbrk(npages * 4096)) == (char*)-1){
+    fprintf(2, "ctxbench: sbrk failed\n");
+    exit(1);
+  }
+  for(j = 0; j < npages; j++)
+    mem[j * 4096] = j;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    fprintf(2, "ctxbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "ctxbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(p1[0], &c, 1) != 1)
+        exit(1);
+      for(j = 0; j < npages; j++)
+        mem[j * 4096]++;
+      write(p2[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  t0 = nsecs();
+  for(i = 0; i < rounds; i++){
+    write(p1[1], &c, 1);
+    if(read(p2[0], &c, 1) != 1){
+      fprintf(2, "ctxbench: child died\n");
+      exit(1);
+    }
+    for(j = 0; j < npages; j++)
+      mem[j * 4096]++;
+  }
+  t1 = nsecs();
+  wait(0);
+
+  // each round is two switches.
+  printf("%d rounds, %d pages touched per switch: %lu ns per switch\n",
+         rounds, npages, (t1 - t0) / rounds / 2);
+  exit(0);
+}
@@ -22,6 +22,7 @@ main(void)
   }
   dup(0);  // stdout
   dup(0);  // stderr
+  mknod("statistics", STATS, 0);
 
   for(;;){
     printf("init: starting sh\n");
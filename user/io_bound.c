@@ -51,7 +51,7 @@ void shuffle_lines(const char *filename, int *p_write_time, int *p_read_time) {
         int pos1 = indices[i];
         int pos2 = indices[LINE_COUNT - i - 1];
 
-        int aux = uptime();
+        uint64 aux = usecs();
         // Read first line
         read(fd, line1, LINE_LENGTH);
         // Skip to the next line (assuming lines are of fixed length)
@@ -60,14 +60,14 @@ void shuffle_lines(const char *filename, int *p_write_time, int *p_read_time) {
         read(fd, line2, LINE_LENGTH);
         // Skip to the next line
         for (int j = 1; j < pos2; j++) read(fd, line2, LINE_LENGTH);
-        *p_read_time += uptime() - aux;
+        *p_read_time += usecs() - aux;
 
-        aux = uptime();
+        aux = usecs();
         // Write second line to the first line's position
         write(fd, line2, LINE_LENGTH);
         // Write first line to the second line's position
         write(fd, line1, LINE_LENGTH);
-        *p_write_time += uptime() - aux;
+        *p_write_time += usecs() - aux;
     }
 
     close(fd);
@@ -91,24 +91,24 @@ int main() {
     const char *filename = "tempfile.txt";
     char line[LINE_LENGTH];
 
-    // Write lines to file
-    int write_time = uptime();
+    // Write lines to file; times are in microseconds
+    uint64 start = usecs();
     int fd = open(filename, O_CREATE | O_WRONLY | O_APPEND);
     for (int i = 0; i < LINE_COUNT; i++) {
         generate_random_line(line);
         write(fd, line, LINE_LENGTH);
     }
     close(fd);
-    write_time = uptime() - write_time;
+    int write_time = usecs() - start;
 
     // Shuffle lines in the file
     int read_time = 0;
     shuffle_lines(filename, &write_time, &read_time);
 
     // Delete the file
-    int delete_time = uptime();
+    start = usecs();
     unlink(filename);
-    delete_time = uptime() - delete_time;
+    int delete_time = usecs() - start;
 
     // Log the metrics
     log_metrics(write_time, read_time, delete_time);
@@ -1,5 +1,6 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/rusage.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
 
@@ -7,12 +8,21 @@
 #define MAX_LINE_LENGTH 100
 #define LINE_BUFFER_SIZE 128
 
+// Times are measured in microseconds with usecs(), but the
+// metrics are still scaled as if they were in the 100 ms
+// clock ticks returned by uptime(), so they stay comparable
+// with earlier runs.
+#define TICK_US 100000
+
 typedef struct {
     int throughput;
     int process_justice;
     int fs_efficiency;
     int memory_overhead;
     int system_performance;
+    int run_time;
+    int wait_time;
+    int sleep_time;
 } Metrics;
 
 typedef struct {
@@ -90,25 +100,33 @@ MemFS parse_and_calculate_metrics(int cpu_count, int io_count) {
 Metrics collect_metrics(int cpu_count, int io_count) {
     int pid, status;
     int processes_completed = 0;
-    int total_exec_time = 0, sum_exec_time_sq = 0;
+    uint64 total_exec_time = 0, sum_exec_time_sq = 0;
+    int run_time = 0, wait_time = 0, sleep_time = 0;
+    struct rusage ru;
 
     // Create file
     int fd = open("raw_data.txt", O_CREATE);
     close(fd);
 
-    int start_time = uptime();
+    uint64 start_time = usecs();
     // Fork CPU-bound processes
     for (int i = 0; i < cpu_count; i++) {
-        int proc_start_time = uptime();
+        uint64 proc_start_time = usecs();
         pid = fork();
         if (pid == 0) {
             char *argv[] = {"cpu_bound", 0};
             exec("cpu_bound", argv);
             exit(0);
         } else if (pid > 0) {
-            wait(&status);
-            int proc_end_time = uptime();
-            int exec_time = proc_end_time - proc_start_time;
+            if (waitx(&status, &ru) < 0) {
+                printf("waitx failed\n");
+                exit(1);
+            }
+            run_time += ru.rtime;
+            wait_time += ru.wtime;
+            sleep_time += ru.stime;
+            uint64 proc_end_time = usecs();
+            uint64 exec_time = proc_end_time - proc_start_time;
             total_exec_time += exec_time;
             sum_exec_time_sq += exec_time * exec_time;
             processes_completed++;
@@ -117,24 +135,30 @@ Metrics collect_metrics(int cpu_count, int io_count) {
 
     // Fork IO-bound processes
     for (int i = 0; i < io_count; i++) {
-        int proc_start_time = uptime();
+        uint64 proc_start_time = usecs();
         pid = fork();
         if (pid == 0) {
             char *argv[] = {"io_bound", 0};
             exec("io_bound", argv);
             exit(0);
         } else if (pid > 0) {
-            wait(&status);
-            int proc_end_time = uptime();
-            int exec_time = proc_end_time - proc_start_time;
+            if (waitx(&status, &ru) < 0) {
+                printf("waitx failed\n");
+                exit(1);
+            }
+            run_time += ru.rtime;
+            wait_time += ru.wtime;
+            sleep_time += ru.stime;
+            uint64 proc_end_time = usecs();
+            uint64 exec_time = proc_end_time - proc_start_time;
             total_exec_time += exec_time;
             sum_exec_time_sq += exec_time * exec_time;
             processes_completed++;
         }
     }
     
-    int end_time = uptime();
-    int total_time = end_time - start_time;
+    uint64 end_time = usecs();
+    uint64 total_time = end_time - start_time;
 
     MemFS t = parse_and_calculate_metrics(cpu_count, io_count);
 
@@ -146,31 +170,37 @@ Metrics collect_metrics(int cpu_count, int io_count) {
 
     // Throughput
     if (total_time > 0) {
-        metrics.throughput = (1000 * processes_completed) / total_time;
+        metrics.throughput = (1000L * TICK_US * processes_completed) / total_time;
     }
 
     // Process Justice
+    // (ordered to keep the microsecond products within 64 bits)
     if (processes_completed > 0 && sum_exec_time_sq > 0) {
-        metrics.process_justice = (1000 * total_exec_time * total_exec_time) / 
-        (processes_completed * sum_exec_time_sq);
+        metrics.process_justice = (1000 * total_exec_time / processes_completed)
+        * total_exec_time / sum_exec_time_sq;
     }
 
     // Filesystem Efficiency
-    int total_fs_time = t.io_write_time + t.io_read_time + t.io_delete_time;
+    uint64 total_fs_time = t.io_write_time + t.io_read_time + t.io_delete_time;
     if (total_fs_time > 0) {
-        metrics.fs_efficiency = (1000 / total_fs_time);
+        metrics.fs_efficiency = (1000L * TICK_US) / total_fs_time;
     }
 
     // Memory Overhead
-    int total_memory_time = t.memory_access_time + t.memory_alloc_time + t.memory_free_time;
+    uint64 total_memory_time = t.memory_access_time + t.memory_alloc_time + t.memory_free_time;
     if (total_memory_time > 0) {
-        metrics.memory_overhead = (1000 / total_memory_time);
+        metrics.memory_overhead = (1000L * TICK_US) / total_memory_time;
     }
 
     // System Performance
     metrics.system_performance = (metrics.throughput + metrics.process_justice
     + metrics.fs_efficiency + metrics.memory_overhead) / 4;
 
+    // Where the children's time went
+    metrics.run_time = run_time;
+    metrics.wait_time = wait_time;
+    metrics.sleep_time = sleep_time;
+
     return metrics;
 }
 
@@ -195,6 +225,8 @@ void run_experiment() {
         printf("Filesystem Efficiency: %d\n", metrics.fs_efficiency);
         printf("Memory Overhead: %d\n", metrics.memory_overhead);
         printf("System Performance: %d\n", metrics.system_performance);
+        printf("Run/Wait/Sleep ticks: %d/%d/%d\n", metrics.run_time,
+               metrics.wait_time, metrics.sleep_time);
         printf("\n");
     }
 }
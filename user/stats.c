@@ -0,0 +1,23 @@
+// stats: print the kernel's lock contention and
+// allocator statistics.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char buf[512];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n;
+
+  if((fd = open("statistics", O_RDONLY)) < 0){
+    fprintf(2, "stats: cannot open statistics\n");
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    write(1, buf, n);
+  close(fd);
+  exit(0);
+}
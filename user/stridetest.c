@@ -0,0 +1,91 @@
+// stridetest: check that CPU-bound processes get CPU time
+// in proportion to their tickets. Runs one spinning child
+// per entry of tickets[] for the given number of ticks, and
+// compares each child's run time, from waitx(), with its
+// share of the total. The shares are small enough that no
+// child is entitled to more than a whole CPU on up to four
+// CPUs, where proportional share can't hold. The default
+// run is long enough that a few ticks of balancing error
+// stay within TOLERANCE for the smallest share.
+//
+// usage: stridetest [ticks]
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+#define NJOB 6
+#define TOLERANCE 5     // percent
+
+int tickets[NJOB] = { 10, 10, 20, 20, 40, 40 };
+
+int
+main(int argc, char *argv[])
+{
+  int duration = 600, fds[2], pid[NJOB], rtime[NJOB];
+  int i, j, n, w, status, total, sumtickets, want, fail;
+  struct rusage ru;
+  volatile int x;
+  char c;
+
+  if(argc > 1)
+    duration = atoi(argv[1]);
+  if(duration <= 0){
+    fprintf(2, "usage: stridetest [ticks]\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "stridetest: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NJOB; i++){
+    pid[i] = fork();
+    if(pid[i] < 0){
+      fprintf(2, "stridetest: fork failed\n");
+      exit(1);
+    }
+    if(pid[i] == 0){
+      close(fds[1]);
+      if(settickets(tickets[i]) < 0)
+        exit(1);
+      // wait until every child is ready, so that they
+      // all start together.
+      read(fds[0], &c, 1);
+      int end = uptime() + duration;
+      x = 0;
+      while(uptime() < end)
+        for(j = 0; j < 100000; j++)
+          x++;
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  for(n = 0; n < NJOB; n++){
+    if((w = waitx(&status, &ru)) < 0 || status != 0){
+      fprintf(2, "stridetest: child failed\n");
+      exit(1);
+    }
+    for(i = 0; i < NJOB; i++)
+      if(pid[i] == w)
+        rtime[i] = ru.rtime;
+  }
+
+  total = sumtickets = 0;
+  for(i = 0; i < NJOB; i++){
+    total += rtime[i];
+    sumtickets += tickets[i];
+  }
+  fail = 0;
+  for(i = 0; i < NJOB; i++){
+    want = total * tickets[i] / sumtickets;
+    printf("tickets %d: ran %d ticks, expected %d\n", tickets[i], rtime[i], want);
+    if(rtime[i] * 100 < want * (100 - TOLERANCE) ||
+       rtime[i] * 100 > want * (100 + TOLERANCE))
+      fail = 1;
+  }
+  printf(fail ? "stridetest: FAILED\n" : "stridetest: OK\n");
+  exit(fail);
+}
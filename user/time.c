@@ -0,0 +1,40 @@
+// time: run a command and report how its lifetime
+// was split between running, waiting for a CPU,
+// and sleeping.
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int pid, status;
+  struct rusage ru;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [arg ...]\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+
+  if(waitx(&status, &ru) < 0){
+    fprintf(2, "time: waitx failed\n");
+    exit(1);
+  }
+
+  printf("%s: real %d run %d wait %d sleep %d ticks, %d voluntary %d involuntary switches\n",
+         argv[1], ru.etime - ru.ctime, ru.rtime, ru.wtime, ru.stime,
+         ru.nvcsw, ru.nivcsw);
+  exit(status);
+}
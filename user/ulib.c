@@ -1,6 +1,10 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/time.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 //
@@ -145,3 +149,38 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// the kernel's read-only data page for this process.
+static volatile struct vdso *vdso = (struct vdso *)VDSO;
+
+// like getpid() and uptime(), but without a system call.
+int
+ugetpid(void)
+{
+  return vdso->pid;
+}
+
+int
+uuptime(void)
+{
+  return vdso->ticks;
+}
+
+// nanoseconds since boot, the same clock as
+// clock_gettime(CLOCK_MONOTONIC), read directly
+// from the time CSR rather than with a system call.
+uint64
+nsecs(void)
+{
+  uint64 t = r_time();
+  uint64 hz = vdso->timebase;
+
+  return t / hz * 1000000000 + (t % hz) * 1000000000 / hz;
+}
+
+// microseconds since boot.
+uint64
+usecs(void)
+{
+  return nsecs() / 1000;
+}
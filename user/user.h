@@ -1,4 +1,6 @@
 struct stat;
+struct rusage;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -22,6 +24,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int settickets(int);
+int waitx(int*, struct rusage*);
+int clock_gettime(int, struct timespec*);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -37,6 +44,10 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int ugetpid(void);
+int uuptime(void);
+uint64 nsecs(void);
+uint64 usecs(void);
 
 // umalloc.c
 void* malloc(uint);
@@ -2429,6 +2429,38 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// the kernel's copies to and from user memory must not
+// reach the stack guard page either.
+void
+copyguard(char *s)
+{
+  char *guard = (char *) (PGROUNDDOWN(r_sp()) - USERSTACK*PGSIZE);
+  int fd;
+
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if(read(fd, guard, 16) != -1){
+    printf("%s: read into the guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("copyguard", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: open copyguard failed\n", s);
+    exit(1);
+  }
+  if(write(fd, guard, 16) != -1){
+    printf("%s: write from the guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("copyguard");
+}
+
 // check that writes to a few forbidden addresses
 // cause a fault, e.g. process's text and TRAMPOLINE.
 void
@@ -2569,6 +2601,318 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// mmap() of a file, shared and private, and of anonymous
+// memory; shared pages are written back on munmap() and are
+// shared with a child after fork().
+void
+mmaptest(char *s)
+{
+  static char buf[2*PGSIZE];
+  char *p, *q;
+  int fd, i, pid, xstatus;
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, PGSIZE);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(memcmp(p, buf, sizeof(buf)) != 0 || memcmp(q, buf+PGSIZE, PGSIZE) != 0){
+    printf("%s: mapped contents differ from the file\n", s);
+    exit(1);
+  }
+  q[0] = 'Q';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[1] = 'C';
+    exit(0);
+  }
+  wait(&xstatus);
+  p[0] = 'P';
+  if(xstatus != 0 || p[1] != 'C'){
+    printf("%s: shared mapping not shared with child\n", s);
+    exit(1);
+  }
+  if(munmap(p, sizeof(buf)) < 0 || munmap(q, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // the shared writes reached the file; the private one didn't.
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+     buf[0] != 'P' || buf[1] != 'C' || buf[PGSIZE] != 'a' + PGSIZE % 26){
+    printf("%s: file contents wrong after munmap\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  if(p[PGSIZE] != 0){
+    printf("%s: anonymous memory not zero\n", s);
+    exit(1);
+  }
+  p[2*PGSIZE] = 1;
+  // unmap a hole in the middle.
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || munmap(p, 3*PGSIZE) < 0){
+    printf("%s: anonymous munmap failed\n", s);
+    exit(1);
+  }
+}
+
+// sbrk() only reserves memory; pages are allocated when first
+// touched, whether by the process itself, by a system call
+// copying into them, or after fork().
+void
+sbrklazy(char *s)
+{
+  uint64 sz = 1024*1024*1024;
+  char *a, *p;
+  int fd, pid, xstatus;
+
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(1GB) failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  a[sz-1] = 2;
+
+  // the kernel must fault in an untouched page for read().
+  p = a + sz/2;
+  fd = open("README", O_RDONLY);
+  if(fd < 0 || read(fd, p, 16) != 16){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[0] != 1 || a[sz-1] != 2 || a[sz/4] != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong lazy memory\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-sz) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-1GB) failed\n", s);
+    exit(1);
+  }
+}
+
+// a large heap region may be mapped with 2-megabyte pages,
+// which fork() and a partial sbrk(-n) must split.
+void
+megapages(char *s)
+{
+  uint64 mb = 2*1024*1024;
+  char *a, *p;
+  int i, pid, xstatus;
+
+  a = sbrk(0);
+  if(sbrk(3*mb) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  // a whole megapage-aligned region in the middle.
+  p = (char*)(((uint64)a + mb - 1) & ~(mb - 1));
+  for(i = 0; i < mb; i += 4096)
+    p[i] = i / 4096;
+
+  // give back the heap down to the middle of the region.
+  if(sbrk(-((a + 3*mb) - (p + mb/2))) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < mb/2; i += 4096){
+      if(p[i] != (char)(i / 4096))
+        exit(1);
+      p[i] = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+  for(i = 0; i < mb/2; i += 4096){
+    if(p[i] != (char)(i / 4096)){
+      printf("%s: parent's memory changed\n", s);
+      exit(1);
+    }
+  }
+
+  if(sbrk(-(p + mb/2 - a)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+}
+
+// pages freed by one process, and then handed out again
+// (perhaps from the kernel's pool of pre-zeroed pages),
+// must read as zero in the next.
+void
+zeropages(char *s)
+{
+  int i, j, pid, xstatus;
+  int n = 64;
+  char *a;
+
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    a = sbrk(n * 4096);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < n * 4096; j += 512){
+      if(a[j] != 0){
+        printf("%s: page not zeroed\n", s);
+        exit(1);
+      }
+      a[j] = 0x5a;
+    }
+    if(pid == 0)
+      exit(0);
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+    sbrk(-(n * 4096));
+  }
+}
+
+// the file of a running program can't be written or
+// truncated, since its pages are read in as they are
+// first touched.
+void
+textbusy(char *s)
+{
+  int fd;
+
+  fd = open("/usertests", O_WRONLY);
+  if(fd < 0){
+    printf("%s: open /usertests failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != -1){
+    printf("%s: write to a running program succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("/usertests", O_WRONLY|O_TRUNC);
+  if(fd >= 0){
+    printf("%s: truncate of a running program succeeded\n", s);
+    exit(1);
+  }
+}
+
+// a file read sequentially, so that the kernel reads ahead,
+// and then through two descriptors at once, so that the
+// reads jump back and forth, must read back as written.
+void
+readahead(char *s)
+{
+  int fd, fd1, fd2, i, j, n;
+  int nblocks = 80;
+
+  fd = open("readahead", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create readahead failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < nblocks; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("readahead", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open readahead failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < nblocks * BSIZE; i += n){
+    n = read(fd, buf, 100);
+    if(n <= 0){
+      printf("%s: short read at %d\n", s, i);
+      exit(1);
+    }
+    for(j = 0; j < n; j++){
+      if(buf[j] != (char)((i + j) / BSIZE)){
+        printf("%s: wrong data at %d\n", s, i + j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+
+  fd1 = open("readahead", O_RDONLY);
+  fd2 = open("readahead", O_RDONLY);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: open readahead failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < nblocks / 2; i++)
+    read(fd2, buf, BSIZE);
+  for(i = 0; i < nblocks / 2; i++){
+    if(read(fd1, buf, BSIZE) != BSIZE || buf[0] != (char)i ||
+       read(fd2, buf, BSIZE) != BSIZE || buf[BSIZE-1] != (char)(nblocks / 2 + i)){
+      printf("%s: wrong data in block %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd1);
+  close(fd2);
+  unlink("readahead");
+}
+
 
 
 // regression test. test whether exec() leaks memory if one of the
@@ -2645,10 +2989,17 @@ struct test {
   {argptest, "argptest"},
   {stacktest, "stacktest"},
   {nowrite, "nowrite"},
+  {copyguard, "copyguard"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {sbrklazy, "sbrklazy"},
+  {mmaptest, "mmaptest"},
+  {megapages, "megapages"},
+  {zeropages, "zeropages"},
+  {readahead, "readahead"},
+  {textbusy, "textbusy"},
   {badarg, "badarg" },
 
   { 0, 0},
@@ -2939,6 +3290,53 @@ outofinodes(char *s)
   }
 }
 
+// fork a process using two thirds of physical memory, which
+// only fits if the child shares the parent's pages
+// copy-on-write, and check that writes by either process
+// are not seen by the other.
+void
+cowfork(char *s)
+{
+  uint64 sz = (PHYSTOP - KERNBASE) / 3 * 2;
+  char *p, *a;
+  int pid, xstatus;
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%ld) failed\n", s, sz);
+    exit(1);
+  }
+  for(a = p; a < p + sz; a += PGSIZE)
+    *(int*)a = 1;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(a = p; a < p + sz; a += 8*PGSIZE)
+      *(int*)a = 2;
+    for(a = p; a < p + sz; a += PGSIZE){
+      if(*(int*)a != ((a - p) % (8*PGSIZE) == 0 ? 2 : 1)){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  wait(&xstatus);
+  for(a = p; a < p + sz; a += PGSIZE){
+    if(*(int*)a != 1){
+      printf("%s: parent sees child's write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-sz);
+  exit(xstatus);
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2946,6 +3344,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {cowfork, "cowfork"},
     
   { 0, 0},
 };
@@ -36,3 +36,8 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("settickets");
+entry("waitx");
+entry("clock_gettime");
+entry("mmap");
+entry("munmap");